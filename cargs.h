@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
 #include "cstring.h"
 
 #define CONCAT(a, b) a##b
@@ -28,12 +29,28 @@
  * */
 
 static inline char str_to_int(const char* s, int* i) {
-  *i = atoi(s);
+  string_t s_arg = str_null;
+  int64_t value;
+
+  str_borrow(&s_arg, s, strlen(s));
+  if (str_parse_i64(s_arg, &value, (size_t*)0) != STR_PARSE_OK ||
+      value < INT_MIN || value > INT_MAX)
+    return 0;
+
+  *i = (int)value;
   return 1;
 }
 
 static inline char str_to_long(const char* s, long* l) {
-  *l = atol(s);
+  string_t s_arg = str_null;
+  int64_t value;
+
+  str_borrow(&s_arg, s, strlen(s));
+  if (str_parse_i64(s_arg, &value, (size_t*)0) != STR_PARSE_OK ||
+      value < LONG_MIN || value > LONG_MAX)
+    return 0;
+
+  *l = (long)value;
   return 1;
 }
 
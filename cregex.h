@@ -5,12 +5,27 @@
 
 typedef struct cregex cregex_t;
 
+/* bytes of DFA state cache a lazy regex may use when none is given */
+#ifndef CREGEX_CACHE_DEFAULT
+#define CREGEX_CACHE_DEFAULT (1 << 20)
+#endif
+
+/* builds the DFA of cregex_match_entire, the states cregex_search and
+   cregex_find need are built while they match. Searches thus mutate the
+   regex and must not run on the same regex from several threads at once */
 cregex_t *cregex_compile(const char *pattern, char **err);
+/* keeps the NFA and builds DFA states while matching, flushing the states of
+   a DFA when they grow past cache_size bytes. Matching then mutates the
+   regex, so a lazy regex must not be shared between threads */
+cregex_t *cregex_compile_lazy(const char *pattern, size_t cache_size, char **err);
 
 void cregex_free(cregex_t *r);
 
 int cregex_match_entire(const cregex_t *r, const char *text);
 int cregex_search(const cregex_t *r, const char *text);
+/* leftmost-longest non-empty match in text[0, len): 1 and its span
+   [*start, *end), 0 if there is none */
+int cregex_find(const cregex_t *r, const char *text, size_t len, size_t *start, size_t *end);
 
 #endif
 #ifdef CREGEX_IMPLEMENTATION
@@ -24,17 +39,20 @@ enum { SPRIT = -1, MATCH = -2, DOT = -3 };
 typedef struct State State;
 struct State {
     int c;
+    int id;
     State *out;
     State *out1;
     State *next;
 };
 
 static State *state_list = NULL;
+static int state_count = 0;
 
 static State *newstate(int c, State *out, State *out1) {
     State *s = (State*)malloc(sizeof(State));
     if (!s) return NULL;
     s->c = c; s->out = out; s->out1 = out1; s->next = state_list; state_list = s;
+    s->id = state_count++;
     return s;
 }
 
@@ -55,13 +73,6 @@ static State ***outs_make(int n) {
     return arr;
 }
 
-static State ***outs_dup(State ***a, int n) {
-    State ***r = (State***)malloc(sizeof(State**) * n);
-    if (!r) return NULL;
-    for (int i = 0; i < n; ++i) r[i] = a[i];
-    return r;
-}
-
 static State ***outs_join(State ***a, int na, State ***b, int nb) {
     State ***r = (State***)malloc(sizeof(State**) * (na + nb));
     if (!r) return NULL;
@@ -165,7 +176,15 @@ static Frag frag_char_literal(const char *token, int tlen) {
     return f;
 }
 
-static Frag build_nfa(const char *postfix, char **err) {
+/* frees the outs of the fragments left on a failed build and the stack */
+static void frags_free(Frag *stack, int sp) {
+    while (sp) free(stack[--sp].outs);
+    free(stack);
+}
+
+/* reverse builds the NFA of the reversed pattern: concatenations swap.
+ * the outs of a fragment are freed once it is patched into a bigger one */
+static Frag build_nfa(const char *postfix, int reverse, char **err) {
     int L = strlen(postfix);
     Frag *stack = (Frag*)malloc(sizeof(Frag) * (L+2));
     int sp = 0;
@@ -179,11 +198,12 @@ static Frag build_nfa(const char *postfix, char **err) {
             continue;
         }
         if (c == '*') {
-            if (sp == 0) { if (err) *err = strdup("bad *"); free(stack); return (Frag){0}; }
+            if (sp == 0) { if (err) *err = strdup("bad *"); frags_free(stack, sp); return (Frag){0}; }
             Frag a = stack[--sp];
             State *s = newstate(SPRIT, a.start, NULL);
 
             patch(a.outs, a.out_count, s);
+            free(a.outs);
 
             State **ptr = &s->out1;
             State ***outs_p = (State***)malloc(sizeof(State**)); outs_p[0] = ptr;
@@ -192,19 +212,21 @@ static Frag build_nfa(const char *postfix, char **err) {
             continue;
         }
         if (c == '&') {
-            if (sp < 2) { if (err) *err = strdup("bad concat"); free(stack); return (Frag){0}; }
+            if (sp < 2) { if (err) *err = strdup("bad concat"); frags_free(stack, sp); return (Frag){0}; }
             Frag b = stack[--sp]; Frag a = stack[--sp];
+            if (reverse) { Frag t = a; a = b; b = t; }
             patch(a.outs, a.out_count, b.start);
-            State ***outs_p = outs_dup(b.outs, b.out_count);
-            Frag f = { a.start, outs_p, b.out_count };
+            free(a.outs);
+            Frag f = { a.start, b.outs, b.out_count };
             stack[sp++] = f;
             continue;
         }
         if (c == '|') {
-            if (sp < 2) { if (err) *err = strdup("bad |"); free(stack); return (Frag){0}; }
+            if (sp < 2) { if (err) *err = strdup("bad |"); frags_free(stack, sp); return (Frag){0}; }
             Frag b = stack[--sp]; Frag a = stack[--sp];
             State *s = newstate(SPRIT, a.start, b.start);
             State ***outs_p = outs_join(a.outs, a.out_count, b.outs, b.out_count);
+            free(a.outs); free(b.outs);
             Frag f = { s, outs_p, a.out_count + b.out_count };
             stack[sp++] = f;
             continue;
@@ -217,195 +239,471 @@ static Frag build_nfa(const char *postfix, char **err) {
             continue;
         }
     }
-    if (sp != 1) { if (err) *err = strdup("bad regex"); free(stack); return (Frag){0}; }
+    if (sp != 1) { if (err) *err = strdup("bad regex"); frags_free(stack, sp); return (Frag){0}; }
     Frag out = stack[0]; free(stack);
 
     State *m = newstate(MATCH, NULL, NULL);
     patch(out.outs, out.out_count, m);
+    free(out.outs); out.outs = NULL; out.out_count = 0;
     return out;
 }
 
-/* Epsilon-closure */
-typedef struct SList { State **s; int n; } SList;
+/* Sparse set of NFA state ids: O(1) insert, test and clear, dense keeps the
+ * insertion order. sparse is zeroed once so it is never read uninitialized. */
+typedef struct { int *dense; int *sparse; int n; } SSet;
 
-static void addstate(State **list, int *n, State *s) {
-    if (!s) return;
-    for (int i = 0; i < *n; ++i) if (list[i] == s) return;
-    list[(*n)++] = s;
+static int sset_init(SSet *s, int cap) {
+    s->dense = (int*)malloc(sizeof(int) * (cap ? cap : 1));
+    s->sparse = (int*)calloc(cap ? cap : 1, sizeof(int));
+    s->n = 0;
+    return s->dense && s->sparse;
 }
 
-static SList eclosure(State **states, int n) {
-    State **stack = (State**)malloc(sizeof(State*) * 1024);
-    int sp = 0;
-    State **out = (State**)malloc(sizeof(State*) * 1024);
-    int on = 0;
-    for (int i = 0; i < n; ++i) { stack[sp++] = states[i]; }
-    while (sp) {
-        State *s = stack[--sp];
-        if (!s) continue;
+static void sset_free(SSet *s) { free(s->dense); free(s->sparse); }
 
-        if (s->c == SPRIT) {
-            if (s->out) stack[sp++] = s->out;
-            if (s->out1) stack[sp++] = s->out1;
-        } else {
-            addstate(out, &on, s);
-        }
-    }
-
-    SList r = { out, on };
-    free(stack);
-    return r;
+static int sset_has(const SSet *s, int id) {
+    unsigned i = (unsigned)s->sparse[id];
+    return i < (unsigned)s->n && s->dense[i] == id;
 }
 
-static SList move_states(State **states, int n, unsigned char ch) {
-    State **out = (State**)malloc(sizeof(State*) * 1024);
-    int on = 0;
-    for (int i = 0; i < n; ++i) {
-        State *s = states[i];
-        if (!s) continue;
-        if (s->c == (int)ch || s->c == DOT) {
-            if (s->out) addstate(out, &on, s->out);
-        }
-    }
-    SList r = { out, on };
-    return r;
+static void sset_add(SSet *s, int id) {
+    if (sset_has(s, id)) return;
+    s->sparse[id] = s->n; s->dense[s->n++] = id;
 }
 
+/* transitions: DEAD if there is no next state, UNKNOWN if not computed yet */
+enum { DEAD = -1, UNKNOWN = -2 };
+
 typedef struct {
+    /* next state for each byte class */
     int *trans;
     int accept;
-    State **nfastates;
+    /* sorted ids of the NFA states (without splits) and their hash */
+    int *nfastates;
     int n_nfa;
+    unsigned hash;
 } DState;
 
-struct cregex {
+/* DFA over one of the NFAs of a regex */
+typedef struct {
     DState *states;
     int nstates;
     int start;
+    int cap;
+    /* open addressing index of states by NFA state set, -1 is empty */
+    int *index;
+    int index_cap;
+    /* bytes used by the states, at most the cache size of a lazy regex */
+    size_t cache_used;
+    State **nfa;
+    int nfa_start;
+    /* the closure of the NFA start joins every step, as if the pattern
+       began with .*, and ids of that closure (without splits) */
+    int unanchored;
+    int *init;
+    int ninit;
+    /* transitions are computed while matching (UNKNOWN until then), the
+       states are flushed when they grow past cache_max bytes */
+    int lazy;
+    size_t cache_max;
+} Dfa;
+
+struct cregex {
+    /* the pattern anchored and unanchored, the reversed pattern unanchored */
+    Dfa fwd;
+    Dfa any;
+    Dfa rev;
+    /* bytes the pattern cannot tell apart share a class */
+    unsigned char classes[256];
+    unsigned char rep[256];
+    int nclasses;
+    /* NFA states by id, of the pattern and the reversed pattern */
+    State **nfa;
+    int nnfa;
+    State **rnfa;
+    int nrnfa;
+    /* scratch of the subset construction, sized to the larger NFA */
+    SSet set;
+    int *stack;
+    int *saved;
 };
 
-static int find_dstate(DState *dstates, int nd, State **nfastates, int nnfa) {
-    for (int i = 0; i < nd; ++i) {
-        if (dstates[i].n_nfa != nnfa) continue;
-        int match = 1;
-        for (int j = 0; j < nnfa; ++j) if (dstates[i].nfastates[j] != nfastates[j]) { match = 0; break; }
-        if (match) return i;
+/* Epsilon-closure, the set is extended in place (splits included) */
+static void eclosure(cregex_t *r, const Dfa *dfa, SSet *set) {
+    int sp = 0;
+    for (int i = 0; i < set->n; ++i) r->stack[sp++] = set->dense[i];
+    while (sp) {
+        State *s = dfa->nfa[r->stack[--sp]];
+        if (s->c != SPRIT) continue;
+        State *outs[2] = { s->out, s->out1 };
+        for (int i = 0; i < 2; ++i) {
+            if (outs[i] && !sset_has(set, outs[i]->id)) {
+                sset_add(set, outs[i]->id);
+                r->stack[sp++] = outs[i]->id;
+            }
+        }
+    }
+}
+
+static void move_ids(const Dfa *dfa, const int *ids, int n, unsigned char ch, SSet *out) {
+    for (int i = 0; i < n; ++i) {
+        State *s = dfa->nfa[ids[i]];
+        if ((s->c == (int)ch || s->c == DOT) && s->out) sset_add(out, s->out->id);
     }
-    return -1;
 }
 
-cregex_t *cregex_compile(const char *pattern, char **err) {
-    if (!pattern) { if (err) *err = strdup("null pattern"); return NULL; }
-    state_list = NULL;
-    char *post = infix_to_postfix(pattern, err);
-    if (!post) return NULL;
-    Frag nfa = build_nfa(post, err);
-    free(post);
-    if (!nfa.start) { if (err && !*err) *err = strdup("failed to build nfa"); return NULL; }
+static void move_states(const Dfa *dfa, const DState *d, unsigned char ch, SSet *out) {
+    out->n = 0;
+    move_ids(dfa, d->nfastates, d->n_nfa, ch, out);
+    if (dfa->unanchored) move_ids(dfa, dfa->init, dfa->ninit, ch, out);
+}
 
-    State *init_arr[1] = { nfa.start };
-    SList s0 = eclosure(init_arr, 1);
+/* Splits the bytes into classes at the edges of every literal, DOT matches
+ * all bytes and splits nothing */
+static void byte_classes(cregex_t *r) {
+    unsigned char edge[257] = {0};
+    for (int i = 0; i < r->nnfa; ++i) {
+        int c = r->nfa[i]->c;
+        if (c >= 0) { edge[c] = 1; edge[c + 1] = 1; }
+    }
+    int k = 0;
+    for (int b = 0; b < 256; ++b) {
+        if (b && edge[b]) k++;
+        r->classes[b] = (unsigned char)k;
+    }
+    r->nclasses = k + 1;
+    /* first byte of each class */
+    for (int b = 255; b >= 0; --b) r->rep[r->classes[b]] = (unsigned char)b;
+}
 
-    DState *dstates = NULL; int nd = 0; int cap = 0;
+static int cmp_id(const void *a, const void *b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
 
-    auto_add:
-    ;
-    if (nd + 1 > cap) {
-        int nc = cap ? cap * 2 : 16;
-        DState *tmp = (DState*)realloc(dstates, sizeof(DState) * nc);
-        if (!tmp) { if (err) *err = strdup("malloc failed"); return NULL; }
-        dstates = tmp; cap = nc;
+static unsigned hash_ids(const int *ids, int n) {
+    unsigned h = 2166136261u;
+    for (int i = 0; i < n; ++i) { h ^= (unsigned)ids[i]; h *= 16777619u; }
+    return h;
+}
+
+static int index_grow(Dfa *dfa) {
+    int cap = dfa->index_cap ? dfa->index_cap * 2 : 64;
+    int *index = (int*)malloc(sizeof(int) * cap);
+    if (!index) return 0;
+    for (int i = 0; i < cap; ++i) index[i] = -1;
+    for (int i = 0; i < dfa->nstates; ++i) {
+        unsigned j = dfa->states[i].hash & (unsigned)(cap - 1);
+        while (index[j] != -1) j = (j + 1) & (unsigned)(cap - 1);
+        index[j] = i;
     }
+    free(dfa->index);
+    dfa->index = index; dfa->index_cap = cap;
+    return 1;
+}
 
-    State **arr0 = s0.s; int n0 = s0.n;
+/* Sorts the non-split ids of the closed set into r->stack, returns their count */
+static int dstate_key(cregex_t *r, const Dfa *dfa, const SSet *set) {
+    int n = 0;
+    for (int i = 0; i < set->n; ++i)
+        if (dfa->nfa[set->dense[i]]->c != SPRIT) r->stack[n++] = set->dense[i];
+    qsort(r->stack, n, sizeof(int), cmp_id);
+    return n;
+}
 
-    for (int i = 1; i < n0; ++i) {
-        State *v = arr0[i]; int j = i - 1; while (j >= 0 && arr0[j] > v) { arr0[j+1] = arr0[j]; j--; } arr0[j+1] = v;
+/* Index slot holding the state of the key in r->stack, or the empty slot for it */
+static unsigned dstate_slot(const cregex_t *r, const Dfa *dfa, int n, unsigned h) {
+    unsigned j = h & (unsigned)(dfa->index_cap - 1);
+    for (; dfa->index[j] != -1; j = (j + 1) & (unsigned)(dfa->index_cap - 1)) {
+        const DState *d = &dfa->states[dfa->index[j]];
+        if (d->hash == h && d->n_nfa == n && !memcmp(d->nfastates, r->stack, sizeof(int) * n))
+            break;
     }
-    dstates[nd].nfastates = arr0; dstates[nd].n_nfa = n0;
-    dstates[nd].trans = (int*)malloc(sizeof(int) * 256);
-    for (int i = 0; i < 256; ++i) dstates[nd].trans[i] = -1;
-    dstates[nd].accept = 0;
-    for (int i = 0; i < n0; ++i) if (arr0[i]->c == MATCH) dstates[nd].accept = 1;
-    nd++;
-
-    for (int idx = 0; idx < nd; ++idx) {
-
-        State **src = dstates[idx].nfastates; int sn = dstates[idx].n_nfa;
-        for (int ch = 0; ch < 256; ++ch) {
-            SList moved = move_states(src, sn, (unsigned char)ch);
-            if (moved.n == 0) { free(moved.s); continue; }
-            SList closure = eclosure(moved.s, moved.n);
-            free(moved.s);
-
-            for (int i = 1; i < closure.n; ++i) {
-                State *v = closure.s[i]; int j = i - 1; while (j >= 0 && closure.s[j] > v) { closure.s[j+1] = closure.s[j]; j--; } closure.s[j+1] = v;
-            }
-            int found = find_dstate(dstates, nd, closure.s, closure.n);
-            if (found == -1) {
-                if (nd + 1 > cap) {
-                    int nc = cap ? cap * 2 : 16;
-                    DState *tmp = (DState*)realloc(dstates, sizeof(DState) * nc);
-                    if (!tmp) { if (err) *err = strdup("malloc failed"); return NULL; }
-                    dstates = tmp; cap = nc;
-                }
-                dstates[nd].nfastates = closure.s; dstates[nd].n_nfa = closure.n;
-                dstates[nd].trans = (int*)malloc(sizeof(int) * 256);
-                for (int i = 0; i < 256; ++i) dstates[nd].trans[i] = -1;
-                dstates[nd].accept = 0;
-                for (int i = 0; i < closure.n; ++i) if (closure.s[i]->c == MATCH) dstates[nd].accept = 1;
-                dstates[idx].trans[ch] = nd;
-                nd++;
-            } else {
-                dstates[idx].trans[ch] = found;
-                free(closure.s);
-            }
+    return j;
+}
+
+/* Bytes a state of n NFA states takes, index slots included */
+static size_t dstate_cost(const cregex_t *r, int n) {
+    return sizeof(DState) + sizeof(int) * (size_t)(r->nclasses + n + 2);
+}
+
+/* New state for the key in r->stack at the empty slot j. -1 if out of memory */
+static int dstate_add(cregex_t *r, Dfa *dfa, int n, unsigned h, unsigned j) {
+    if (dfa->nstates + 1 > dfa->cap) {
+        int nc = dfa->cap ? dfa->cap * 2 : 16;
+        DState *tmp = (DState*)realloc(dfa->states, sizeof(DState) * nc);
+        if (!tmp) return -1;
+        dfa->states = tmp; dfa->cap = nc;
+    }
+
+    DState *d = &dfa->states[dfa->nstates];
+    d->nfastates = (int*)malloc(sizeof(int) * (n ? n : 1));
+    d->trans = (int*)malloc(sizeof(int) * r->nclasses);
+    if (!d->nfastates || !d->trans) { free(d->nfastates); free(d->trans); return -1; }
+    memcpy(d->nfastates, r->stack, sizeof(int) * n);
+    d->n_nfa = n; d->hash = h;
+    for (int i = 0; i < r->nclasses; ++i) d->trans[i] = dfa->lazy ? UNKNOWN : DEAD;
+    d->accept = 0;
+    for (int i = 0; i < n; ++i) if (dfa->nfa[r->stack[i]]->c == MATCH) d->accept = 1;
+    dfa->cache_used += dstate_cost(r, n);
+
+    dfa->index[j] = dfa->nstates++;
+    if (dfa->nstates * 2 > dfa->index_cap && !index_grow(dfa)) return -1;
+    return dfa->nstates - 1;
+}
+
+/* DFA state of the (closed) set, created if it is new. -1 if out of memory */
+static int dstate_get(cregex_t *r, Dfa *dfa, const SSet *set) {
+    int n = dstate_key(r, dfa, set);
+    unsigned h = hash_ids(r->stack, n), j = dstate_slot(r, dfa, n, h);
+    if (dfa->index[j] != -1) return dfa->index[j];
+    return dstate_add(r, dfa, n, h, j);
+}
+
+static void dstate_put(cregex_t *r, const int *ids, int n) {
+    r->set.n = 0;
+    for (int i = 0; i < n; ++i) sset_add(&r->set, ids[i]);
+}
+
+/* Start state: the closure of the NFA start, or nothing yet when unanchored */
+static int dfa_start(cregex_t *r, Dfa *dfa) {
+    r->set.n = 0;
+    if (!dfa->unanchored) {
+        sset_add(&r->set, dfa->nfa_start);
+        eclosure(r, dfa, &r->set);
+    }
+    return dfa->start = dstate_get(r, dfa, &r->set);
+}
+
+static void dfa_clear(Dfa *dfa) {
+    for (int i = 0; i < dfa->nstates; ++i) {
+        free(dfa->states[i].trans);
+        free(dfa->states[i].nfastates);
+    }
+    dfa->nstates = 0;
+    dfa->cache_used = 0;
+}
+
+static void dfa_free(Dfa *dfa) {
+    dfa_clear(dfa);
+    free(dfa->states);
+    free(dfa->index);
+    free(dfa->init);
+}
+
+/* cache_max 0: every state is built by dfa_build */
+static int dfa_init(cregex_t *r, Dfa *dfa, State **nfa, int nfa_start, int unanchored,
+                    size_t cache_max) {
+    dfa->nfa = nfa;
+    dfa->nfa_start = nfa_start;
+    dfa->unanchored = unanchored;
+    dfa->lazy = cache_max != 0;
+    dfa->cache_max = cache_max;
+    if (!index_grow(dfa)) return 0;
+    if (unanchored) {
+        dstate_put(r, &nfa_start, 1);
+        eclosure(r, dfa, &r->set);
+        dfa->ninit = dstate_key(r, dfa, &r->set);
+        dfa->init = (int*)malloc(sizeof(int) * (dfa->ninit ? dfa->ninit : 1));
+        if (!dfa->init) return 0;
+        memcpy(dfa->init, r->stack, sizeof(int) * dfa->ninit);
+    }
+    return dfa_start(r, dfa) >= 0;
+}
+
+/* Subset construction of every reachable state */
+static int dfa_build(cregex_t *r, Dfa *dfa) {
+    for (int idx = 0; idx < dfa->nstates; ++idx) {
+        for (int k = 0; k < r->nclasses; ++k) {
+            move_states(dfa, &dfa->states[idx], r->rep[k], &r->set);
+            /* no state is dead once the start closure joins every step */
+            if (r->set.n == 0 && !dfa->unanchored) continue;
+            eclosure(r, dfa, &r->set);
+            int t = dstate_get(r, dfa, &r->set);
+            if (t < 0) return 0;
+            dfa->states[idx].trans[k] = t;
         }
     }
+    return 1;
+}
 
-    cregex_t *r = (cregex_t*)malloc(sizeof(cregex_t));
-    r->states = dstates; r->nstates = nd; r->start = 0;
+/* Drops every cached state, then brings back the start state, *cur and the
+   target whose key is in r->stack. Returns the target, -1 if out of memory */
+static int cache_flush(cregex_t *r, Dfa *dfa, int *cur, int n) {
+    int *target = r->saved, *ids = r->saved + (r->nnfa > r->nrnfa ? r->nnfa : r->nrnfa);
+    int ncur = dfa->states[*cur].n_nfa;
+    memcpy(target, r->stack, sizeof(int) * n);
+    memcpy(ids, dfa->states[*cur].nfastates, sizeof(int) * ncur);
+
+    dfa_clear(dfa);
+    for (int i = 0; i < dfa->index_cap; ++i) dfa->index[i] = -1;
+
+    int start = dfa_start(r, dfa);
+    /* saved keys are closed already */
+    dstate_put(r, ids, ncur);
+    *cur = dstate_get(r, dfa, &r->set);
+    dstate_put(r, target, n);
+    int t = dstate_get(r, dfa, &r->set);
+    return start < 0 || *cur < 0 ? -1 : t;
+}
 
+/* Computes and caches a transition of a lazy DFA */
+static int dstate_next(cregex_t *r, Dfa *dfa, int cur, int k) {
+    int t = DEAD;
+    move_states(dfa, &dfa->states[cur], r->rep[k], &r->set);
+    if (r->set.n || dfa->unanchored) {
+        eclosure(r, dfa, &r->set);
+        int n = dstate_key(r, dfa, &r->set);
+        unsigned h = hash_ids(r->stack, n), j = dstate_slot(r, dfa, n, h);
+        if (dfa->index[j] != -1) t = dfa->index[j];
+        else if (dfa->cache_used + dstate_cost(r, n) <= dfa->cache_max) t = dstate_add(r, dfa, n, h, j);
+        else t = cache_flush(r, dfa, &cur, n);
+        /* out of memory, nothing is cached and the match fails */
+        if (t < 0) return DEAD;
+    }
+    dfa->states[cur].trans[k] = t;
+    return t;
+}
+
+static int dstate_step(const cregex_t *r, const Dfa *dfa, int cur, unsigned char c) {
+    int k = r->classes[c], t = dfa->states[cur].trans[k];
+    /* the cache of a lazy DFA is filled while matching */
+    return t == UNKNOWN ? dstate_next((cregex_t*)r, (Dfa*)dfa, cur, k) : t;
+}
+
+/* NFA states of state_list by id, the list is emptied */
+static State **nfa_take(int *n) {
+    State **nfa = (State**)malloc(sizeof(State*) * (state_count ? state_count : 1));
+    if (!nfa) {
+        while (state_list) { State *s = state_list->next; free(state_list); state_list = s; }
+        return NULL;
+    }
+    for (State *st = state_list; st; st = st->next) nfa[st->id] = st;
+    *n = state_count;
+    state_list = NULL; state_count = 0;
+    return nfa;
+}
+
+/* Builds the NFAs and the start states */
+static cregex_t *compile_nfa(const char *pattern, int lazy, size_t cache_size, char **err) {
+    if (!pattern) { if (err) *err = strdup("null pattern"); return NULL; }
+    state_list = NULL; state_count = 0;
+    char *post = infix_to_postfix(pattern, err);
+    if (!post) return NULL;
+    Frag nfa = build_nfa(post, 0, err);
+    if (!nfa.start) { free(post); if (err && !*err) *err = strdup("failed to build nfa"); return NULL; }
+
+    cregex_t *r = (cregex_t*)calloc(1, sizeof(cregex_t));
+    if (!r) { free(post); if (err) *err = strdup("malloc failed"); return NULL; }
+
+    /* the NFAs are owned by the regex from here on */
+    int start = nfa.start->id;
+    r->nfa = nfa_take(&r->nnfa);
+    Frag rnfa = { NULL, NULL, 0 };
+    if (r->nfa) rnfa = build_nfa(post, 1, err);
+    if (rnfa.start) r->rnfa = nfa_take(&r->nrnfa);
+    free(post);
+    if (!r->rnfa) { cregex_free(r); if (err && !*err) *err = strdup("malloc failed"); return NULL; }
+
+    byte_classes(r);
+
+    int n = r->nnfa > r->nrnfa ? r->nnfa : r->nrnfa;
+    r->stack = (int*)malloc(sizeof(int) * n);
+    if (lazy) r->saved = (int*)malloc(sizeof(int) * 2 * n);
+    /* unanchored DFAs can be exponentially larger than the anchored one and
+       are only needed by searches, they are always built while matching,
+       without a bound unless the regex is lazy */
+    size_t search_max = lazy ? cache_size : (size_t)-1;
+    if (!r->stack || (lazy && !r->saved) || !sset_init(&r->set, n) ||
+        !dfa_init(r, &r->fwd, r->nfa, start, 0, lazy ? cache_size : 0) ||
+        !dfa_init(r, &r->any, r->nfa, start, 1, search_max) ||
+        !dfa_init(r, &r->rev, r->rnfa, rnfa.start->id, 1, search_max)) {
+        cregex_free(r); if (err) *err = strdup("malloc failed"); return NULL;
+    }
     return r;
 }
 
-void cregex_free(cregex_t *r) {
-    if (!r) return;
-    for (int i = 0; i < r->nstates; ++i) {
-        free(r->states[i].trans);
-        free(r->states[i].nfastates);
+cregex_t *cregex_compile(const char *pattern, char **err) {
+    cregex_t *r = compile_nfa(pattern, 0, 0, err);
+    if (!r) return NULL;
+    if (!dfa_build(r, &r->fwd)) {
+        cregex_free(r); if (err) *err = strdup("malloc failed"); return NULL;
     }
-    free(r->states);
+    return r;
+}
 
-    State *s = state_list;
-    while (s) { State *n = s->next; free(s); s = n; }
+cregex_t *cregex_compile_lazy(const char *pattern, size_t cache_size, char **err) {
+    return compile_nfa(pattern, 1, cache_size ? cache_size : CREGEX_CACHE_DEFAULT, err);
+}
+
+void cregex_free(cregex_t *r) {
+    if (!r) return;
+    dfa_free(&r->fwd);
+    dfa_free(&r->any);
+    dfa_free(&r->rev);
+    free(r->stack);
+    free(r->saved);
+    sset_free(&r->set);
+
+    for (int i = 0; r->nfa && i < r->nnfa; ++i) free(r->nfa[i]);
+    for (int i = 0; r->rnfa && i < r->nrnfa; ++i) free(r->rnfa[i]);
+    free(r->nfa);
+    free(r->rnfa);
     free(r);
 }
 
 int cregex_match_entire(const cregex_t *r, const char *text) {
     if (!r || !text) return 0;
-    int cur = r->start;
+    int cur = r->fwd.start;
     for (const unsigned char *p = (const unsigned char*)text; *p; ++p) {
-        int nx = r->states[cur].trans[*p];
-        if (nx == -1) return 0;
+        int nx = dstate_step(r, &r->fwd, cur, *p);
+        if (nx == DEAD) return 0;
         cur = nx;
     }
-    return r->states[cur].accept;
+    return r->fwd.states[cur].accept;
 }
 
+/* A state of the unanchored DFA accepts when a non-empty match ends at the
+   byte just read, since the start closure only joins before each byte */
 int cregex_search(const cregex_t *r, const char *text) {
     if (!r || !text) return 0;
-    size_t L = strlen(text);
-    for (size_t i = 0; i < L; ++i) {
-        int cur = r->start;
-        for (size_t j = i; j < L; ++j) {
-            int nx = r->states[cur].trans[(unsigned char)text[j]];
-            if (nx == -1) break;
-            cur = nx;
-            if (r->states[cur].accept) return 1;
-        }
+    int cur = r->any.start;
+    for (const unsigned char *p = (const unsigned char*)text; *p; ++p) {
+        cur = dstate_step(r, &r->any, cur, *p);
+        if (cur == DEAD) return 0;
+        if (r->any.states[cur].accept) return 1;
     }
     return 0;
 }
 
-#endif
\ No newline at end of file
+int cregex_find(const cregex_t *r, const char *text, size_t len, size_t *start, size_t *end) {
+    if (!r || !text) return 0;
+    const unsigned char *p = (const unsigned char*)text;
+
+    /* the reversed pattern read from the end accepts at every byte a
+       non-empty match starts at, the last one is the leftmost */
+    size_t s = len;
+    int cur = r->rev.start;
+    for (size_t i = len; i > 0; --i) {
+        cur = dstate_step(r, &r->rev, cur, p[i - 1]);
+        if (cur == DEAD) return 0;
+        if (r->rev.states[cur].accept) s = i - 1;
+    }
+    if (s == len) return 0;
+
+    /* the longest match from there */
+    size_t e = s;
+    cur = r->fwd.start;
+    for (size_t i = s; i < len; ++i) {
+        cur = dstate_step(r, &r->fwd, cur, p[i]);
+        if (cur == DEAD) break;
+        if (r->fwd.states[cur].accept) e = i + 1;
+    }
+    if (e == s) return 0;
+
+    if (start) *start = s;
+    if (end) *end = e;
+    return 1;
+}
+
+#endif
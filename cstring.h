@@ -2,38 +2,333 @@
 #define C_STRING
 
 #include <ctype.h>
+#include <errno.h>
+#include <sched.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define STR_SIMD_X86
+#include <immintrin.h>
+#endif
 
 #define str(c) str_init_from_chr(c)
 #define strh(c) str_acquire(c)
 
-#define str_null ((string_t){0, 0, 0})
+#define str_null ((string_t){0})
 
 #define STR_HEAP 0x01
 #define STR_OWNER 0x02
+#define STR_SSO 0x04
+#define STR_ARENA 0x08
+// immutable chars shared by reference count, see str_share
+#define STR_SHARED 0x10
+
+// short strings (up to STR_SSO_CAP chars) are stored inside the string_t, in
+// place of str and cap and the bytes up to flags
+#define STR_SSO_SIZE 23
+#define STR_SSO_CAP (STR_SSO_SIZE - 1)
 
 #define str_auto string_t __attribute__((cleanup(str_free)))
 
-typedef struct string {
+#define STR_ARENA_BLOCK_SIZE (64 * 1024)
+
+// reference count of the chars of STR_SHARED strings, allocated apart from
+// them so sharing a heap string doesn't move its chars
+typedef struct str_shared {
+  size_t refs;
   char *str;
+} str_shared_t;
+
+/*
+ * str and cap overlap the inline chars of short strings (STR_SSO), use
+ * str_ptr() to access the chars, flags and len are valid for every string
+ *
+ * cap is the number of chars an owned heap buffer can hold without the null
+ * byte, 0 if unknown (str_acquire_s), STR_SHARED strings keep their reference
+ * count in its place
+ * */
+typedef struct string {
+  __extension__ union {
+    struct {
+      char sso[STR_SSO_SIZE];
+      // behind str and cap, so it is shared by both layouts
+      char flags;
+    };
+    struct {
+      char *str;
+      union {
+        size_t cap;
+        str_shared_t *shared;
+      };
+    };
+  };
   size_t len;
-  char flags;
 } string_t;
 typedef string_t str;
 
+typedef struct str_format_spec {
+  size_t width;
+  int precision;
+  char left, zero;
+} str_format_spec_t;
+
+typedef struct str_arena_block {
+  struct str_arena_block *next;
+  size_t size, used;
+  char data[];
+} str_arena_block_t;
+
+/*
+ * bump allocator for string_t lifetimes, see str_arena_create
+ * */
+typedef struct str_arena {
+  // the block that is allocated from, older blocks follow via next
+  str_arena_block_t *head;
+  size_t block_size;
+} str_arena_t;
+
+// interned chars are preceded by their header in the arena of the table
+typedef struct str_intern_head {
+  uint64_t hash;
+  size_t len;
+} str_intern_head_t;
+
+typedef struct str_intern_table {
+  // the replaced smaller table, readers may still probe it
+  struct str_intern_table *prev;
+  size_t mask;
+  const char *slots[];
+} str_intern_table_t;
+
+#define STR_INTERN_MIN_SLOTS 64
+// busy polls of a waiting writer before it yields the cpu
+#define STR_INTERN_SPINS 64
+
+/*
+ * canonical copies of strings, see str_intern
+ * */
+typedef struct str_intern {
+  str_intern_table_t *table;
+  str_arena_t *arena;
+  size_t count;
+  // serializes writers, lookups never take it
+  char lock;
+} str_intern_t;
+
+// control bytes of str_map_t, full slots store the low 7 hash bits
+#define STR_MAP_EMPTY ((signed char)-128)
+#define STR_MAP_DELETED ((signed char)-2)
+#define STR_MAP_GROUP 16
+
+typedef struct str_map_entry {
+  string_t key;
+  void *value;
+} str_map_entry_t;
+
+/*
+ * open addressing hash map, see str_map_init
+ * */
+typedef struct str_map {
+  // cap + STR_MAP_GROUP control bytes, the first group is mirrored at the end
+  signed char *ctrl;
+  str_map_entry_t *entries;
+  size_t cap, len;
+  // inserts left until the table has to grow (7/8 load)
+  size_t growth_left;
+  uint64_t seed;
+} str_map_t;
+
+#define STR_SEARCH_MEMCHR 0x01
+#define STR_SEARCH_HORSPOOL 0x02
+#define STR_SEARCH_TWOWAY 0x03
+
+// longer needles always use Two-Way
+#define STR_SEARCH_HORSPOOL_MAX 256
+
+/*
+ * precompiled needle, see str_searcher_init
+ * */
+typedef struct str_searcher {
+  string_t needle;
+  char algo;
+  // Two-Way: critical position, period and whether the needle is periodic
+  ssize_t ell;
+  size_t period;
+  char periodic;
+  // Horspool: bad character shifts
+  size_t shift[256];
+} str_searcher_t;
+
+/*
+ * Aho-Corasick automaton of the reversed patterns for str_replace_many, see
+ * str_replacer_init
+ * */
+typedef struct str_replacer {
+  string_t *replacements;
+  size_t *pattern_len;
+  size_t n;
+  // bytes that no pattern can tell apart share a class
+  unsigned int classes[256];
+  size_t nclasses;
+  // trans[node * nclasses + class], failure links are already folded in
+  int *trans;
+  // longest (reversed) pattern ending in the node or -1
+  int *out;
+  size_t nodes, cap;
+} str_replacer_t;
+
+// skip empty tokens instead of returning them
+#define STR_TOKEN_COLLAPSE 0x01
+// split on any byte of the delimiter instead of the whole delimiter
+#define STR_TOKEN_ANY 0x02
+
 typedef struct tokenizer {
   string_t delimiter;
   string_t base;
-  char *start, *end;
+  size_t pos;
+  const str_searcher_t *searcher;
+  char flags;
+  // STR_TOKEN_ANY: bit c is set if byte c is a delimiter
+  uint64_t set[4];
 } tokenizer_t;
 
+// inline chars of a builder piece, enough for a formatted 64 bit integer
+#define STR_PIECE_SIZE 24
+
+/*
+ * one piece of a str_builder_t, short pieces are stored inline
+ * */
+typedef struct str_piece {
+  // borrowed or owned chars, (char *)0 if they are in buf
+  const char *ptr;
+  size_t len;
+  char owned;
+  // a run of len times buf[0], only written out when the builder is finished
+  // or written
+  char fill;
+  char buf[STR_PIECE_SIZE];
+} str_piece_t;
+
+/*
+ * collects pieces and joins them once, see str_builder_init
+ * */
+typedef struct str_builder {
+  str_piece_t *pieces;
+  size_t n, cap;
+  // length of the joined string
+  size_t len;
+} str_builder_t;
+
+/*
+ * sort key of a string_t, the 7 bytes after depth (big endian, zero padded)
+ * and min(remaining length, 8) in the lowest byte, so comparing keys
+ * compares the strings up to depth + 7
+ * */
+typedef struct str_sort_item {
+  uint64_t key;
+  size_t index;
+} str_sort_item_t;
+
+// partitions smaller than this are insertion sorted
+#define STR_SORT_INSERTION 16
+
+/*
+ * immutable front-coded dictionary of sorted strings
+ *
+ * the strings are stored in blocks of STR_DICT_BLOCK, the first of a block
+ * as varint length and chars, the others as varint length of the prefix
+ * shared with the string before, varint length of the rest and the rest
+ * */
+typedef struct str_dict {
+  unsigned char *data;
+  // offset of each block in data
+  size_t *blocks;
+  size_t len, max_len;
+} str_dict_t;
+
+/*
+ * iterates over a range of a str_dict_t
+ * */
+typedef struct str_dict_iter {
+  const str_dict_t *dict;
+  // next id and the end of the range
+  size_t id, end;
+  const unsigned char *p;
+  // the string decoded last
+  char *buf;
+  size_t len;
+} str_dict_iter_t;
+
+#ifndef STR_DICT_BLOCK
+#define STR_DICT_BLOCK 16
+#endif
+
+/*
+ * suffix array over a text, the text itself is not copied
+ * */
+typedef struct str_index {
+  const char *text;
+  size_t len;
+  // suffixes of text in sorted order
+  const size_t *sa;
+  // sa was allocated by str_index_build, not loaded
+  char owned;
+} str_index_t;
+
+// file header of str_index_save, the suffix array follows
+typedef struct str_index_header {
+  char magic[8];
+  uint64_t len;
+  // str_hash of the text with seed 0
+  uint64_t hash;
+  // STR_INDEX_ORDER in the byte order of the writer and sizeof(size_t)
+  uint32_t order;
+  uint32_t width;
+} str_index_header_t;
+
+#define STR_INDEX_MAGIC "STRIDX2"
+#define STR_INDEX_ORDER 0x01020304u
+
+/*
+ * bit-parallel edit distance state (Myers, blocks by Hyyroe) for a pattern
+ * of m bytes in words 64 bit blocks
+ * */
+typedef struct str_myers {
+  // match mask of each byte, words entries per byte
+  uint64_t *peq;
+  // vertical deltas of the current column
+  uint64_t *pv, *mv;
+  size_t m, words;
+  // bit of the last row in the last block
+  uint64_t last;
+  // storage for patterns of up to 64 bytes
+  uint64_t peq_inline[256], pv_inline, mv_inline;
+} str_myers_t;
+
+// results of str_parse_u64 and str_parse_i64
+#define STR_PARSE_OK 0
+#define STR_PARSE_INVALID 1
+#define STR_PARSE_OVERFLOW 2
+
+// max chars written by str_fmt_u64
+#define STR_FMT_U64_MAX 20
+
+// entries per writev call of str_builder_write
+#define STR_BUILDER_IOV 64
+// chars of the buffer str_builder_write repeats for a fill run
+#define STR_BUILDER_RUN 4096
+
 void str_init(string_t *s);
 string_t str_init_from_chr(char *c);
 
 string_t str_transfer(string_t *source);
+string_t str_share(string_t *s);
 string_t str_acquire(const char *c);
 string_t str_acquire_s(const char *c, size_t len);
 
@@ -42,6 +337,9 @@ void str_heapify(string_t *s);
 
 void str_free(string_t *s);
 
+int str_reserve(string_t *s, size_t cap);
+void str_shrink_to_fit(string_t *s);
+
 int str_print(string_t s);
 int str_println(string_t s);
 
@@ -51,16 +349,83 @@ size_t str_len(const string_t s);
 
 int str_equals(const string_t s1, const string_t s2);
 int str_equals_ic(const string_t s1, const string_t s2);
+uint64_t str_hash(const string_t s, uint64_t seed);
+uint64_t str_hash_ic(const string_t s);
 
 size_t str_pos(string_t s, const string_t search);
 size_t str_ipos(string_t s, const string_t search);
+size_t str_count(string_t s, const string_t search);
+
+int str_parse_u64(const string_t s, uint64_t *value, size_t *end);
+int str_parse_i64(const string_t s, int64_t *value, size_t *end);
+size_t str_fmt_u64(char *buf, uint64_t value);
+
+void str_intern_init(str_intern_t *intern);
+void str_intern_free(str_intern_t *intern);
+string_t str_intern(str_intern_t *intern, const string_t s);
+string_t str_intern_find(str_intern_t *intern, const string_t s);
+uint64_t str_intern_hash(const string_t s);
+int str_intern_equals(const string_t s1, const string_t s2);
+
+void str_map_init(str_map_t *map, uint64_t seed);
+void str_map_free(str_map_t *map);
+int str_map_put(str_map_t *map, const string_t key, void *value);
+str_map_entry_t *str_map_find(const str_map_t *map, const string_t key);
+void *str_map_get(const str_map_t *map, const string_t key);
+int str_map_remove(str_map_t *map, const string_t key);
+str_map_entry_t *str_map_next(const str_map_t *map, size_t *pos);
+
+void str_searcher_init(str_searcher_t *searcher, const string_t needle);
+void str_searcher_free(str_searcher_t *searcher);
+size_t str_searcher_find(const str_searcher_t *searcher, const string_t s);
+void str_searcher_find_all(const str_searcher_t *searcher, const string_t s,
+                           size_t **arr, size_t *len);
 
 tokenizer_t str_token_init(string_t s, const string_t delimiter);
+tokenizer_t str_token_init_flags(string_t s, const string_t delimiter,
+                                 char flags);
+tokenizer_t str_token_init_searcher(string_t s,
+                                    const str_searcher_t *searcher);
 char str_token_next(tokenizer_t *tok, string_t *s);
+char str_token_next_view(tokenizer_t *tok, string_t *s);
 
 void str_explode(string_t s, const string_t delimiter, string_t **arr,
                  size_t *len);
+void str_explode_view(const string_t *s, const string_t delimiter,
+                      string_t **arr, size_t *len);
+size_t str_explode_into(const string_t *s, const string_t delimiter,
+                        string_t *arr, size_t cap);
 string_t str_implode(const string_t delimiter, string_t *arr, size_t len);
+size_t str_implode_iov(const string_t *delimiter, const string_t *arr,
+                       size_t len, struct iovec *iov, size_t cap);
+void str_sort(string_t *arr, size_t len);
+
+int str_dict_build(str_dict_t *dict, const string_t *arr, size_t len);
+void str_dict_free(str_dict_t *dict);
+size_t str_dict_find(const str_dict_t *dict, const string_t key);
+string_t str_dict_get(const str_dict_t *dict, size_t id);
+int str_dict_iter(const str_dict_t *dict, const string_t prefix,
+                  str_dict_iter_t *it);
+int str_dict_next(str_dict_iter_t *it, string_t *s);
+void str_dict_iter_free(str_dict_iter_t *it);
+
+int str_index_build(str_index_t *index, const string_t *text);
+void str_index_free(str_index_t *index);
+size_t str_index_count(const str_index_t *index, const string_t search);
+size_t str_index_locate(const str_index_t *index, const string_t search,
+                        size_t *pos, size_t cap);
+size_t str_index_pos(const str_index_t *index, const string_t search);
+int str_index_save(const str_index_t *index, int fd);
+int str_index_load(str_index_t *index, const string_t *text, const void *data,
+                   size_t size);
+
+size_t str_edit_distance(const string_t s1, const string_t s2);
+size_t str_edit_distance_bounded(const string_t s1, const string_t s2,
+                                 size_t max);
+void str_edit_distance_batch(const string_t search, const string_t *arr,
+                             size_t len, size_t max, size_t *dist);
+size_t str_fuzzy_pos(string_t s, const string_t search, size_t max,
+                     size_t *len);
 
 string_t str_tolower(string_t s);
 string_t str_toupper(string_t s);
@@ -69,6 +434,15 @@ string_t str_cat(const string_t s, char *str, ...);
 string_t str_prepend(const string_t s, char *str, ...);
 
 string_t str_replace(string_t s, const string_t search, const string_t replace);
+string_t str_replace_searcher(string_t s, const str_searcher_t *search,
+                              const string_t replace);
+string_t str_replace_many(string_t s, const string_t *patterns,
+                          const string_t *replacements, size_t n);
+
+void str_replacer_init(str_replacer_t *r, const string_t *patterns,
+                       const string_t *replacements, size_t n);
+void str_replacer_free(str_replacer_t *r);
+string_t str_replacer_apply(const str_replacer_t *r, const string_t s);
 
 string_t str_substr(string_t s, ssize_t offset, ssize_t len);
 
@@ -81,6 +455,31 @@ string_t str_rev(const string_t s);
 string_t str_lpad(string_t s, char c, size_t len);
 string_t str_rpad(string_t s, char c, size_t len);
 
+void str_builder_init(str_builder_t *b);
+void str_builder_free(str_builder_t *b);
+int str_builder_add(str_builder_t *b, const string_t s);
+int str_builder_int(str_builder_t *b, long long value);
+int str_builder_uint(str_builder_t *b, unsigned long long value);
+int str_builder_fill(str_builder_t *b, char c, size_t n);
+int str_builder_cat(str_builder_t *b, char *str, ...);
+string_t str_builder_finish(str_builder_t *b);
+ssize_t str_builder_write(const str_builder_t *b, int fd);
+
+str_arena_t *str_arena_create(size_t block_size);
+void str_arena_reset(str_arena_t *arena);
+void str_arena_destroy(str_arena_t *arena);
+
+/*
+ * str_arena_XY => the result is allocated in the arena, str_free is a no-op
+ * */
+
+string_t str_arena_clone(str_arena_t *arena, const string_t s);
+string_t str_arena_cat(str_arena_t *arena, const string_t s, char *str, ...);
+string_t str_arena_replace(str_arena_t *arena, string_t s,
+                           const string_t search, const string_t replace);
+string_t str_arena_substr(str_arena_t *arena, string_t s, ssize_t offset,
+                          ssize_t len);
+
 /*
  * strr_XY => string_t reference functions -> modifies the string passed
  * */
@@ -111,20 +510,215 @@ string_t *strr_rev(string_t *s);
 string_t *strr_lpad(string_t *s, char c, size_t len);
 string_t *strr_rpad(string_t *s, char c, size_t len);
 
-static inline char *str_ptr(const string_t s) {
-  extern const char *const str_empty_chr;
+extern const char *const str_empty_chr;
+
+/*
+ * chars of s, inline strings live inside the string_t itself so the pointer
+ * is only valid as long as *s is
+ * */
+static inline char *str_ptr(const string_t *s) {
+  if (s->flags & STR_SSO)
+    return (char *)s->sso;
 
-  return s.str ? s.str : (char *)str_empty_chr;
+  return s->str ? s->str : (char *)str_empty_chr;
 }
+
 static void str_calc_len(string_t *s);
+
+typedef size_t (*str_find_fn)(const char *hay, size_t n, const char *needle,
+                              size_t m, int icase);
+static size_t str_find(const char *hay, size_t n, const char *needle,
+                       size_t m, int icase);
+static str_find_fn str_find_select(void);
+static size_t str_find_scalar(const char *hay, size_t n, const char *needle,
+                              size_t m, int icase);
+static int str_mem_equals(const char *a, const char *b, size_t len,
+                          int icase);
+static int str_mem_equals_ic(const char *a, const char *b, size_t len);
+static inline unsigned char str_ascii_lower(unsigned char c);
+static inline unsigned char str_ascii_upper(unsigned char c);
+static inline uint64_t str_swar_case(uint64_t w, int upper);
+typedef void (*str_case_fn)(char *dst, const char *src, size_t len,
+                            int upper);
+static void str_case(char *dst, const char *src, size_t len, int upper);
+static str_case_fn str_case_select(void);
+static void str_case_scalar(char *dst, const char *src, size_t len,
+                            int upper);
+static inline void str_hash_mum(uint64_t *a, uint64_t *b);
+static inline uint64_t str_hash_mix(uint64_t a, uint64_t b);
+static uint64_t str_hash_words(const char *chr, size_t len, uint64_t seed,
+                               int icase);
+static ssize_t str_maxsuf(const unsigned char *x, size_t m, size_t *p,
+                          int rev);
+static size_t str_twoway(const str_searcher_t *searcher, const char *hay,
+                         size_t n);
+static string_t str_replace_loop(string_t s, const str_searcher_t *searcher,
+                                 const string_t search,
+                                 const string_t replace);
+static int str_replacer_node(str_replacer_t *r);
+static char *str_arena_alloc(str_arena_t *arena, size_t size);
+static char *str_arena_init(str_arena_t *arena, string_t *s, size_t len);
+static const char *str_intern_probe(const str_intern_table_t *table,
+                                    const char *c, size_t len, uint64_t hash);
+static void str_intern_lock(str_intern_t *intern);
+static str_intern_table_t *str_intern_grow(str_intern_t *intern);
+static const char *str_intern_add(str_intern_t *intern,
+                                  str_intern_table_t *table, const char *c,
+                                  size_t len, uint64_t hash);
+static string_t str_intern_string(const char *c);
+static inline unsigned int str_map_match(const signed char *ctrl,
+                                         signed char h);
+static inline unsigned int str_map_match_free(const signed char *ctrl);
+static void str_map_set_ctrl(str_map_t *map, size_t i, signed char h);
+static size_t str_map_find_free(const str_map_t *map, uint64_t hash);
+static int str_map_resize(str_map_t *map, size_t cap);
+static int str_substr_range(size_t s_len, ssize_t *offset, ssize_t *len);
+static size_t str_token_find(const tokenizer_t *tok, const char *c, size_t n,
+                             size_t *delimiter_len);
+static size_t str_token_find_any(const tokenizer_t *tok, const char *c,
+                                 size_t n);
 void str_clone(string_t *target, string_t s);
 void str_clone_from_chr(string_t *target, char *c, size_t len);
-static string_t str_from_format(char *str, va_list args);
+static string_t str_from_format(const string_t prefix, char *str,
+                                va_list args, const string_t suffix);
+static size_t str_format(char *buf, char *str, va_list args);
+static void str_format_put(char *buf, size_t *len, const char *data,
+                           size_t n);
+static void str_format_fill(char *buf, size_t *len, char c, size_t n);
+static void str_format_pad(char *buf, size_t *len, str_format_spec_t spec,
+                           const char *data, size_t n, int numeric);
+static void str_format_int(char *buf, size_t *len, str_format_spec_t spec,
+                           unsigned long long value, int negative, int base,
+                           int upper);
+static char *str_init_len(string_t *s, size_t len);
 void str_mem_insert(string_t *string, size_t offset, void *data,
                     size_t data_len);
 void str_mem_replace(string_t *string, size_t offset, size_t len, void *data,
                      size_t data_len);
 void str_mem_append(string_t *string, void *data, size_t data_len);
+static char *str_writable(string_t *s, size_t len);
+static char *str_realloc(string_t *s, size_t cap);
+static size_t str_grow_cap(size_t cap, size_t len);
+static void str_keep(string_t *s, size_t offset, size_t len);
+static void str_shared_retain(str_shared_t *head);
+static void str_shared_release(str_shared_t *head);
+static str_piece_t *str_builder_piece(str_builder_t *b, size_t len);
+static size_t str_parse_digits(const char *c, size_t len, uint64_t *value,
+                               int *overflow);
+static size_t str_fmt_digits(uint64_t value);
+static inline uint64_t str_sort_key(const string_t *s, size_t depth);
+static str_sort_item_t *str_sort_items(const string_t *arr, size_t len);
+static void str_sort_mkqs(str_sort_item_t *items, size_t n,
+                          const string_t *arr, size_t depth);
+static void str_sort_insertion(str_sort_item_t *items, size_t n,
+                               const string_t *arr, size_t depth);
+static void str_sort_permute(string_t *arr, str_sort_item_t *items,
+                             size_t len);
+static int str_sort_cmp_at(const string_t *s1, const string_t *s2,
+                           size_t depth);
+static int str_sort_cmp(const void *a, const void *b);
+static size_t str_varint_len(size_t v);
+static unsigned char *str_varint_put(unsigned char *p, size_t v);
+static const unsigned char *str_varint_get(const unsigned char *p, size_t *v);
+static size_t str_dict_lower(const str_dict_t *dict, const char *key,
+                             size_t len, int *found);
+static void str_dict_decode(str_dict_iter_t *it);
+static int str_sais(const void *t, int width, size_t *sa, size_t n,
+                    size_t k);
+static void str_sais_buckets(const void *t, int width, size_t n, size_t k,
+                             size_t *bucket, int end);
+static void str_sais_induce(const void *t, int width, const char *type,
+                            size_t *sa, size_t n, size_t k, size_t *bucket);
+static int str_index_cmp(const str_index_t *index, size_t suffix,
+                         const char *c, size_t m, size_t *lcp);
+static void str_index_range(const str_index_t *index, const char *c, size_t m,
+                            size_t *lo, size_t *hi);
+static int str_myers_init(str_myers_t *my, const char *c, size_t m,
+                          int reverse);
+static void str_myers_free(str_myers_t *my);
+static void str_myers_reset(str_myers_t *my);
+static inline int str_myers_column(str_myers_t *my, unsigned char c, int hin);
+static size_t str_myers_distance(str_myers_t *my, const char *text, size_t n,
+                                 size_t max);
+
+#endif
+
+/*
+ * multithreaded variants, need cthread.c
+ * */
+#if defined(CSTRING_PARALLEL) && !defined(C_STRING_PARALLEL)
+#define C_STRING_PARALLEL
+#include "cthread.h"
+#include <unistd.h>
+
+// smaller inputs are processed by the sequential versions
+#ifndef STR_PARALLEL_MIN
+#define STR_PARALLEL_MIN (4 * 1024 * 1024)
+#endif
+#define STR_PARALLEL_CHUNK (1024 * 1024)
+// match positions a chunk keeps to resynchronize with the one before it
+#define STR_PARALLEL_SYNC 16
+
+#define STR_PARALLEL_POS 0x01
+#define STR_PARALLEL_COUNT 0x02
+#define STR_PARALLEL_REPLACE 0x03
+
+typedef struct str_parallel_chunk {
+  // matches starting in [start, end) belong to the chunk
+  size_t start, end;
+  // greedy scan from start: matches, the first of them, end of the last one
+  size_t count, last_end;
+  size_t sync[STR_PARALLEL_SYNC];
+  // where the sequential scan enters the chunk and the matches before it
+  size_t entry, before;
+} str_parallel_chunk_t;
+
+typedef struct str_parallel_job {
+  char op;
+  const char *text, *needle, *replace;
+  size_t n, m, r;
+  char *dst;
+  str_parallel_chunk_t *chunks;
+  size_t nchunks;
+  // next chunk to hand out and the first chunk with a match (pos)
+  size_t next, found;
+} str_parallel_job_t;
+
+// smaller arrays are sorted by str_sort
+#ifndef STR_SORT_PARALLEL_MIN
+#define STR_SORT_PARALLEL_MIN (64 * 1024)
+#endif
+// str_sort_parallel buckets by the first 2 bytes
+#define STR_SORT_BUCKETS (1 << 16)
+
+typedef struct str_sort_job {
+  str_sort_item_t *items;
+  const string_t *arr;
+  // bucket i is items[bucket[i], bucket[i + 1])
+  size_t *bucket;
+  size_t next;
+} str_sort_job_t;
+
+size_t str_pos_parallel(string_t s, const string_t search,
+                        unsigned int threads);
+size_t str_count_parallel(string_t s, const string_t search,
+                          unsigned int threads);
+string_t str_replace_parallel(string_t s, const string_t search,
+                              const string_t replace, unsigned int threads);
+void str_sort_parallel(string_t *arr, size_t len, unsigned int threads);
+
+static int str_parallel_init(str_parallel_job_t *job, string_t *s,
+                             const string_t *search, unsigned int *threads);
+static void str_parallel_run(str_parallel_job_t *job, unsigned int threads);
+static void str_parallel_spawn(thread_fn_t fn, void *arg,
+                               unsigned int threads);
+static void *str_parallel_worker(void *arg);
+static void str_parallel_scan(const str_parallel_job_t *job,
+                              str_parallel_chunk_t *c);
+static void str_parallel_replace_chunk(const str_parallel_job_t *job,
+                                       const str_parallel_chunk_t *c);
+static size_t str_parallel_stitch(str_parallel_job_t *job);
+static void *str_sort_worker(void *arg);
 #endif
 
 #ifdef CSTRING_IMPLEMENTATION
@@ -135,8 +729,9 @@ const char *const str_empty_chr = "";
  * initilize a string from a stack allocated char*
  * */
 string_t str_init_from_chr(char *c) {
-  string_t s = {.str = c, .len = 0, .flags = 0};
+  string_t s = str_null;
 
+  s.str = c;
   str_init(&s);
 
   return s;
@@ -169,18 +764,49 @@ void str_init(string_t *s) {
  * */
 string_t str_transfer(string_t *source) {
 
-  string_t dest;
-
   if (!source)
     return str_null;
 
-  source->flags &= ~STR_OWNER;
-  dest.str = source->str;
-  dest.flags |= STR_OWNER;
+  string_t dest = *source;
+
+  source->flags &= ~(STR_OWNER | STR_SHARED);
 
   return dest;
 }
 
+/**
+ * returns a reference to the chars of s without copying them, s and the
+ * result are both released with str_free
+ *
+ * an owned heap string is turned into a shared one on the first call (its
+ * chars stay in place, only the reference count is allocated), the first
+ * strr_XY call on any of the references detaches a private copy
+ * inline strings are copied, borrowed and arena strings are returned as is
+ * */
+string_t str_share(string_t *s) {
+
+  if (!s)
+    return str_null;
+
+  if (s->flags & STR_HEAP && s->flags & STR_OWNER) {
+    str_shared_t *head = malloc(sizeof(str_shared_t));
+
+    if (!head)
+      return str_null;
+
+    head->refs = 1;
+    head->str = s->str;
+
+    s->shared = head;
+    s->flags = STR_SHARED;
+  }
+
+  if (s->flags & STR_SHARED)
+    str_shared_retain(s->shared);
+
+  return *s;
+}
+
 /**
  * create a string from a heap allocated char*
  **/
@@ -195,6 +821,7 @@ string_t str_acquire(const char *c) {
   s.flags = STR_HEAP | STR_OWNER;
 
   str_calc_len(&s);
+  s.cap = s.len;
 
   return s;
 }
@@ -211,6 +838,8 @@ string_t str_acquire_s(const char *c, size_t len) {
 
   s.str = (char *)c;
   s.len = len;
+  // the size of the buffer is unknown, the first write reallocates it
+  s.cap = 0;
   s.flags = STR_HEAP | STR_OWNER;
 
   return s;
@@ -242,19 +871,27 @@ void str_heapify(string_t *s) {
   if (!(s->flags & STR_HEAP)) {
     char *tmp = (char*)malloc(s->len + 1);
 
-    if (tmp)
-      memcpy(tmp, str_ptr(*s), s->len);
+    if (!tmp)
+      return;
+
+    memcpy(tmp, str_ptr(s), s->len);
+
+    if (s->flags & STR_SHARED)
+      str_shared_release(s->shared);
 
     *(tmp + s->len) = 0;
     s->str = tmp;
+    s->cap = s->len;
 
     // the char* is heap allocated and the current string_t is the owner of it
+    s->flags &= ~(STR_SSO | STR_ARENA | STR_SHARED);
     s->flags |= STR_HEAP | STR_OWNER;
   }
 }
 
 /**
  * frees the char* if the string is its owner
+ * arena strings are released by their arena, this is a no-op for them
  * */
 void str_free(string_t *s) {
 
@@ -266,12 +903,74 @@ void str_free(string_t *s) {
     s->str = (char *)0;
 
     s->len = 0;
+    s->cap = 0;
+  } else if (s->flags & STR_SHARED) {
+    str_shared_release(s->shared);
+
+    *s = str_null;
+  } else if (s->flags & STR_SSO) {
+    *s = str_null;
+  }
+}
+
+/**
+ * makes sure the string owns a buffer for at least cap chars, so the
+ * following appends up to that size don't reallocate
+ * returns 0 if the allocation failed
+ * */
+int str_reserve(string_t *s, size_t cap) {
+
+  if (!s)
+    return 0;
+
+  if (cap < s->len)
+    cap = s->len;
+
+  if (s->flags & STR_HEAP && s->flags & STR_OWNER) {
+    if (cap <= s->cap)
+      return 1;
+
+    return str_realloc(s, cap) != (char *)0;
+  }
+
+  if (cap <= STR_SSO_CAP)
+    return str_writable(s, s->len) != (char *)0;
+
+  return str_realloc(s, cap) != (char *)0;
+}
+
+/**
+ * releases the unused capacity, short strings are moved back inline
+ * */
+void str_shrink_to_fit(string_t *s) {
+
+  if (!s)
+    return;
+
+  if (!(s->flags & STR_HEAP && s->flags & STR_OWNER))
+    return;
+
+  if (s->len <= STR_SSO_CAP) {
+    char *heap = s->str;
+
+    memcpy(s->sso, heap, s->len);
+    *(s->sso + s->len) = 0;
+
+    s->flags = STR_SSO;
+
+    free(heap);
+    return;
   }
+
+  if (s->cap > s->len)
+    str_realloc(s, s->len);
 }
 
-int str_print(string_t s) { return printf("%.*s", (int)s.len, s.str); }
+int str_print(string_t s) { return printf("%.*s", (int)s.len, str_ptr(&s)); }
 
-int str_println(string_t s) { return printf("%.*s\n", (int)s.len, s.str); }
+int str_println(string_t s) {
+  return printf("%.*s\n", (int)s.len, str_ptr(&s));
+}
 
 /**
  * check if a char is ' ', '\t' or '\r'
@@ -289,24 +988,21 @@ int str_chr_is_ws(const char *c) {
 size_t str_len(const string_t s) { return s.len; }
 
 /**
- * append to the given string (see str_from_format)
+ * append to the given string (see str_format)
  * */
 string_t str_cat(const string_t string, char *str, ...) {
-  string_t new_s;
-  str_clone(&new_s, string);
 
   va_list args;
   va_start(args, str);
 
-  // Forward to strr_cat
-  strr_catv(&new_s, str, args);
+  string_t new_s = str_from_format(string, str, args, str_null);
 
   va_end(args);
   return new_s;
 }
 
 /**
- * append to the given string (see str_from_format)
+ * append to the given string (see str_format)
  * */
 string_t *strr_cat(string_t *s, char *str, ...) {
 
@@ -328,39 +1024,62 @@ static void strr_catv(string_t *s, char *str, va_list args) {
   if (!s)
     return;
 
-  str_auto formatted = str_from_format(str, args);
+  va_list args_len;
+  va_copy(args_len, args);
 
-  if (!*str_ptr(*s)) {
-    // free the base string if str_null or empty
-    str_free(s);
+  size_t len = str_format((char *)0, str, args_len);
 
-    // If the destination string is empty, just clone the formatted string
-    str_clone(s, formatted);
-  } else {
-    // Concatenate formatted string to the end
-    str_mem_append(s, str_ptr(formatted), formatted.len);
+  va_end(args_len);
+
+  // a %S argument can point into s, so a buffer that has to grow is copied
+  // instead of reallocated and freed after formatting
+  char *old = (char *)0;
+  if (s->flags & STR_HEAP && s->flags & STR_OWNER && s->len + len > s->cap) {
+    old = s->str;
+    s->flags &= ~STR_OWNER;
+  }
+
+  // the same for the last reference of shared chars
+  str_shared_t *shared =
+      s->flags & STR_SHARED ? s->shared : (str_shared_t *)0;
+  if (shared)
+    str_shared_retain(shared);
+
+  char *c = str_writable(s, s->len + len);
+
+  if (c) {
+    // Format directly behind the current end
+    str_format(c + s->len, str, args);
+
+    s->len += len;
+    *(c + s->len) = 0;
+  } else if (old) {
+    s->flags |= STR_OWNER;
+    old = (char *)0;
   }
+
+  free(old);
+
+  if (shared)
+    str_shared_release(shared);
 }
 
 /**
- * prepend to the given string (see str_from_format)
+ * prepend to the given string (see str_format)
  * */
 string_t str_prepend(const string_t s, char *str, ...) {
-  string_t new_s;
-  str_clone(&new_s, s);
 
   va_list args;
   va_start(args, str);
 
-  // Forward to strr_cat
-  strr_prependv(&new_s, str, args);
+  string_t new_s = str_from_format(str_null, str, args, s);
 
   va_end(args);
   return new_s;
 }
 
 /**
- * prepend to the given string (see str_from_format)
+ * prepend to the given string (see str_format)
  * */
 string_t *strr_prepend(string_t *s, char *str, ...) {
 
@@ -382,25 +1101,10 @@ static void strr_prependv(string_t *s, char *str, va_list args) {
   if (!s)
     return;
 
-  str_heapify(s);
-
-  str_auto formatted = str_from_format(str, args);
-
-  if (!*str_ptr(*s)) {
-    // free the base string if str_null or empty
-    str_free(s);
-    // If the destination string is empty, just clone the formatted string
-    str_clone(s, formatted);
-  } else {
-    // concatenate formatted string to the end
-    str_mem_append(&formatted, str_ptr(*s), s->len);
-
-    // free the old one
-    str_free(s);
+  string_t new_s = str_from_format(str_null, str, args, *s);
 
-    // clone the new one
-    str_clone(s, formatted);
-  }
+  str_free(s);
+  *s = new_s;
 }
 
 /**
@@ -411,7 +1115,7 @@ int str_equals(const string_t s1, const string_t s2) {
     return 0;
   }
 
-  return !strcmp(str_ptr(s1), str_ptr(s2));
+  return !memcmp(str_ptr(&s1), str_ptr(&s2), s1.len);
 }
 
 /**
@@ -421,21 +1125,148 @@ int str_equals_ic(const string_t s1, const string_t s2) {
   if (s1.len != s2.len)
     return 0;
 
-  char *s1_chr = (char *)str_ptr(s1);
-  char *s2_chr = (char *)str_ptr(s2);
-  for (; *s1_chr; s1_chr++, s2_chr++) {
-    if (!(tolower(*s1_chr) == tolower(*s2_chr)))
-      return 0;
+  return str_mem_equals_ic(str_ptr(&s1), str_ptr(&s2), s1.len);
+}
+
+/**
+ * seeded 64 bit hash of s (wyhash), long strings are consumed 48 bytes per
+ * step in three independent lanes
+ * */
+uint64_t str_hash(const string_t s, uint64_t seed) {
+  return str_hash_words(str_ptr(&s), s.len, seed, 0);
+}
+
+/**
+ * case insensitive (ascii) hash of s, strings that are equal by str_equals_ic
+ * hash to the same value without building a lowered copy
+ * */
+uint64_t str_hash_ic(const string_t s) {
+  return str_hash_words(str_ptr(&s), s.len, 0, 1);
+}
+
+#define STR_HASH_P0 0xa0761d6478bd642full
+#define STR_HASH_P1 0xe7037ed1a0b428dbull
+#define STR_HASH_P2 0x8ebc6af09c88c6e3ull
+#define STR_HASH_P3 0x589965cc75374cc3ull
+
+static inline uint64_t str_hash_r8(const unsigned char *p, int icase) {
+  uint64_t w;
+  memcpy(&w, p, 8);
+
+  return icase ? str_swar_case(w, 0) : w;
+}
+
+static inline uint64_t str_hash_r4(const unsigned char *p, int icase) {
+  uint32_t w;
+  memcpy(&w, p, 4);
+
+  return icase ? str_swar_case(w, 0) : w;
+}
+
+static inline uint64_t str_hash_r1(const unsigned char *p, int icase) {
+  return icase ? str_ascii_lower(*p) : *p;
+}
+
+/**
+ * str_hash, icase lowers every word before it is mixed in
+ * */
+static uint64_t str_hash_words(const char *chr, size_t len, uint64_t seed,
+                               int icase) {
+  const unsigned char *p = (const unsigned char *)chr;
+  uint64_t a, b;
+
+  seed ^= str_hash_mix(seed ^ STR_HASH_P0, STR_HASH_P1);
+
+  if (len <= 16) {
+    if (len >= 4) {
+      // two overlapping reads from each end cover 4..16 bytes
+      size_t off = (len >> 3) << 2;
+      a = (str_hash_r4(p, icase) << 32) | str_hash_r4(p + off, icase);
+      b = (str_hash_r4(p + len - 4, icase) << 32) |
+          str_hash_r4(p + len - 4 - off, icase);
+    } else if (len > 0) {
+      a = (str_hash_r1(p, icase) << 16) |
+          (str_hash_r1(p + (len >> 1), icase) << 8) |
+          str_hash_r1(p + len - 1, icase);
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = len;
+
+    if (i > 48) {
+      uint64_t see1 = seed, see2 = seed;
+
+      do {
+        seed = str_hash_mix(str_hash_r8(p, icase) ^ STR_HASH_P1,
+                            str_hash_r8(p + 8, icase) ^ seed);
+        see1 = str_hash_mix(str_hash_r8(p + 16, icase) ^ STR_HASH_P2,
+                            str_hash_r8(p + 24, icase) ^ see1);
+        see2 = str_hash_mix(str_hash_r8(p + 32, icase) ^ STR_HASH_P3,
+                            str_hash_r8(p + 40, icase) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+
+      seed ^= see1 ^ see2;
+    }
+
+    while (i > 16) {
+      seed = str_hash_mix(str_hash_r8(p, icase) ^ STR_HASH_P1,
+                          str_hash_r8(p + 8, icase) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+
+    // the last 16 bytes, overlapping what was already consumed
+    a = str_hash_r8(p + i - 16, icase);
+    b = str_hash_r8(p + i - 8, icase);
   }
 
-  return 1;
+  a ^= STR_HASH_P1;
+  b ^= seed;
+  str_hash_mum(&a, &b);
+
+  return str_hash_mix(a ^ STR_HASH_P0 ^ len, b ^ STR_HASH_P1);
+}
+
+/**
+ * 64x64 -> 128 bit multiply, a gets the low and b the high half
+ * */
+static inline void str_hash_mum(uint64_t *a, uint64_t *b) {
+#ifdef __SIZEOF_INT128__
+  __uint128_t r = (__uint128_t)*a * *b;
+
+  *a = (uint64_t)r;
+  *b = (uint64_t)(r >> 64);
+#else
+  uint64_t ha = *a >> 32, la = (uint32_t)*a;
+  uint64_t hb = *b >> 32, lb = (uint32_t)*b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32);
+  uint64_t lo = t + (rm1 << 32);
+
+  *a = lo;
+  *b = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl) + (lo < t);
+#endif
+}
+
+/**
+ * the 128 bit product folded back to 64 bits
+ * */
+static inline uint64_t str_hash_mix(uint64_t a, uint64_t b) {
+  str_hash_mum(&a, &b);
+
+  return a ^ b;
 }
 
 string_t str_tolower(string_t s) {
   string_t new;
-  str_clone(&new, s);
+  char *c = str_init_len(&new, s.len);
 
-  strr_tolower(&new);
+  if (c)
+    str_case(c, str_ptr(&s), s.len, 0);
 
   return new;
 }
@@ -445,20 +1276,22 @@ string_t *strr_tolower(string_t *s) {
   if (!s)
     return s;
 
-  str_heapify(s);
+  char *c = str_writable(s, s->len);
+
+  if (!c)
+    return s;
 
-  for (int i = 0; i < s->len; i++)
-    s->str[i] = tolower(s->str[i]);
+  str_case(c, c, s->len, 0);
 
   return s;
 }
 
 string_t str_toupper(string_t s) {
   string_t new;
+  char *c = str_init_len(&new, s.len);
 
-  str_clone(&new, s);
-
-  strr_toupper(&new);
+  if (c)
+    str_case(c, str_ptr(&s), s.len, 1);
 
   return new;
 }
@@ -468,906 +1301,5251 @@ string_t *strr_toupper(string_t *s) {
   if (!s)
     return s;
 
-  str_heapify(s);
+  char *c = str_writable(s, s->len);
+
+  if (!c)
+    return s;
 
-  for (int i = 0; i < s->len; i++)
-    s->str[i] = toupper(s->str[i]);
+  str_case(c, c, s->len, 1);
 
   return s;
 }
 
-void str_calc_len(string_t *s) {
-
-  if (!s || !s->str)
-    return;
-
-  size_t len = 0;
-  char *chr = s->str;
-  for (; *chr; chr++)
-    len++;
+/*
+ * case conversion only maps the ascii letters, independent of the locale,
+ * bytes >= 0x80 are left alone
+ * */
 
-  s->len = len;
+static inline unsigned char str_ascii_lower(unsigned char c) {
+  return (unsigned char)(c - 'A') < 26 ? c | 0x20 : c;
 }
 
-/**
- * returns the position of the first occurence of search in s (case sensitive)
- * returns -1 if search is not found
- * */
-size_t str_pos(string_t s, const string_t search) {
-  size_t pos = -1;
+static inline unsigned char str_ascii_upper(unsigned char c) {
+  return (unsigned char)(c - 'a') < 26 ? c & 0xdf : c;
+}
 
-  if (!*str_ptr(search))
-    return 0;
+#define STR_SWAR_ONES 0x0101010101010101ull
+#define STR_SWAR_HIGH 0x8080808080808080ull
 
-  if (!*str_ptr(s))
-    return -1;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define STR_SWAR_LE
+#endif
 
-  if (s.len < search.len)
-    return -1;
+/**
+ * converts the case of 8 bytes at once
+ * */
+static inline uint64_t str_swar_case(uint64_t w, int upper) {
+  uint64_t from = upper ? 'a' : 'A';
+  uint64_t low7 = w & ~STR_SWAR_HIGH;
 
-  if (str_equals(s, search))
-    return 0;
+  // the high bit of each byte is set when from <= byte <= from + 25
+  uint64_t ge = low7 + STR_SWAR_ONES * (0x80 - from);
+  uint64_t gt = low7 + STR_SWAR_ONES * (0x80 - from - 26);
+  uint64_t letter = ge & ~gt & ~w & STR_SWAR_HIGH;
 
-  char *c = s.str;
-  char *cl = c;
-  char *c_end = c + s.len - 1;
-  char *search_c = search.str;
-  while (*cl && cl <= c_end) {
+  return w ^ (letter >> 2);
+}
 
-    while (*c && *c == *search_c && c <= c_end) {
-      c++, search_c++;
-    }
+static void str_case_scalar(char *dst, const char *src, size_t len,
+                            int upper) {
+  size_t i = 0;
 
-    // found the string
-    if (!*search_c) {
-      return cl - s.str;
-    } else {
-      // set the str to the next base str
-      c = cl;
-      // reset search pointer
-      search_c = search.str;
-    }
-    cl++, c++;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t w;
+    memcpy(&w, src + i, 8);
+    w = str_swar_case(w, upper);
+    memcpy(dst + i, &w, 8);
   }
 
-  return pos;
+  for (; i < len; i++)
+    dst[i] = (char)(upper ? str_ascii_upper((unsigned char)src[i])
+                          : str_ascii_lower((unsigned char)src[i]));
 }
 
-/**
- * returns the position of the first occurence of search in s (case insensitive)
- * returns -1 if search is not found
- * */
-size_t str_ipos(string_t s, const string_t search) {
-  size_t pos = -1;
+#ifdef STR_SIMD_X86
 
-  if (!*str_ptr(search))
-    return 0;
+/*
+ * a byte is a letter of the source case when byte + (0x80 - from) lands in
+ * [-128, -128 + 26) as a signed byte, those get bit 0x20 flipped
+ * */
 
-  if (!*str_ptr(s))
-    return -1;
+static inline __m128i str_case_sse2_block(__m128i v, __m128i shift,
+                                          __m128i bound) {
+  __m128i letter = _mm_cmplt_epi8(_mm_add_epi8(v, shift), bound);
 
-  if (s.len < search.len)
-    return -1;
+  return _mm_xor_si128(v, _mm_and_si128(letter, _mm_set1_epi8(0x20)));
+}
 
-  if (str_equals(s, search))
-    return 0;
+static void str_case_sse2(char *dst, const char *src, size_t len,
+                          int upper) {
+  const __m128i shift = _mm_set1_epi8((char)(0x80 - (upper ? 'a' : 'A')));
+  const __m128i bound = _mm_set1_epi8(-128 + 26);
 
-  char *c = s.str;
-  char *cl = c;
-  char *c_end = c + s.len - 1;
-  char *search_c = search.str;
-  while (*cl && cl <= c_end) {
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dst + i),
+                     str_case_sse2_block(v, shift, bound));
+  }
 
-    while (*c && tolower(*c) == tolower(*search_c) && c <= c_end) {
-      c++, search_c++;
-    }
+  str_case_scalar(dst + i, src + i, len - i, upper);
+}
 
-    // found the string
-    if (!*search_c) {
-      return cl - s.str;
-    } else {
-      // set the str to the next base str
-      c = cl;
-      // reset search pointer
-      search_c = search.str;
-    }
-    cl++, c++;
+__attribute__((target("avx2"))) static void
+str_case_avx2(char *dst, const char *src, size_t len, int upper) {
+  const __m256i shift = _mm256_set1_epi8((char)(0x80 - (upper ? 'a' : 'A')));
+  const __m256i bound = _mm256_set1_epi8(-128 + 26);
+  const __m256i flip = _mm256_set1_epi8(0x20);
+
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+    __m256i letter = _mm256_cmpgt_epi8(bound, _mm256_add_epi8(v, shift));
+    _mm256_storeu_si256((__m256i *)(dst + i),
+                        _mm256_xor_si256(v, _mm256_and_si256(letter, flip)));
   }
 
-  return pos;
+  str_case_sse2(dst + i, src + i, len - i, upper);
 }
 
+#endif
+
 /**
- * splits the given string into an array of strings
+ * picks the fastest case conversion kernel the cpu supports
  * */
-void str_explode(string_t s, const string_t delimiter, string_t **arr,
-                 size_t *len) {
+static str_case_fn str_case_select(void) {
+#ifdef STR_SIMD_X86
+  __builtin_cpu_init();
 
-  *arr = malloc(sizeof(string_t));
-  *len = 0;
+  if (__builtin_cpu_supports("avx2"))
+    return str_case_avx2;
+
+  return str_case_sse2;
+#else
+  return str_case_scalar;
+#endif
+}
+
+/**
+ * writes src converted to lower (or upper) case to dst, dst may be src
+ * */
+static void str_case(char *dst, const char *src, size_t len, int upper) {
+  static str_case_fn kernel;
+
+  str_case_fn fn = __atomic_load_n(&kernel, __ATOMIC_RELAXED);
+
+  if (!fn) {
+    fn = str_case_select();
+    __atomic_store_n(&kernel, fn, __ATOMIC_RELAXED);
+  }
+
+  fn(dst, src, len, upper);
+}
+
+void str_calc_len(string_t *s) {
+
+  if (!s || !s->str)
+    return;
+
+  size_t len = 0;
+  char *chr = s->str;
+  for (; *chr; chr++)
+    len++;
+
+  s->len = len;
+}
+
+/**
+ * returns the position of the first occurence of search in s (case sensitive)
+ * returns -1 if search is not found
+ * */
+size_t str_pos(string_t s, const string_t search) {
+
+  if (!search.len)
+    return 0;
+
+  if (!s.len)
+    return -1;
+
+  if (s.len < search.len)
+    return -1;
+
+  return str_find(str_ptr(&s), s.len, str_ptr(&search), search.len, 0);
+}
+
+/**
+ * returns the position of the first occurence of search in s (case insensitive)
+ * returns -1 if search is not found
+ * */
+size_t str_ipos(string_t s, const string_t search) {
+
+  if (!search.len)
+    return 0;
+
+  if (!s.len)
+    return -1;
+
+  if (s.len < search.len)
+    return -1;
+
+  return str_find(str_ptr(&s), s.len, str_ptr(&search), search.len, 1);
+}
+
+/**
+ * returns the number of non overlapping occurences of search in s, counted
+ * left to right like str_replace replaces them
+ * */
+size_t str_count(string_t s, const string_t search) {
+
+  if (!search.len)
+    return 0;
+
+  const char *c = str_ptr(&s);
+  size_t p = 0, count = 0, pos;
+
+  while ((pos = str_find(c + p, s.len - p, str_ptr(&search), search.len, 0)) !=
+         -1) {
+    count++;
+    p += pos + search.len;
+  }
+
+  return count;
+}
+
+/**
+ * compares len bytes, optionally case insensitive
+ * */
+static int str_mem_equals(const char *a, const char *b, size_t len,
+                          int icase) {
+
+  if (!icase)
+    return !memcmp(a, b, len);
+
+  return str_mem_equals_ic(a, b, len);
+}
+
+/**
+ * compares len bytes case insensitive (ascii), both sides are lowered a
+ * block at a time
+ * */
+static int str_mem_equals_ic(const char *a, const char *b, size_t len) {
+  size_t i = 0;
+
+#ifdef STR_SIMD_X86
+  const __m128i shift = _mm_set1_epi8((char)(0x80 - 'A'));
+  const __m128i bound = _mm_set1_epi8(-128 + 26);
+
+  for (; i + 16 <= len; i += 16) {
+    __m128i va = str_case_sse2_block(
+        _mm_loadu_si128((const __m128i *)(a + i)), shift, bound);
+    __m128i vb = str_case_sse2_block(
+        _mm_loadu_si128((const __m128i *)(b + i)), shift, bound);
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xffff)
+      return 0;
+  }
+#endif
+
+  for (; i + 8 <= len; i += 8) {
+    uint64_t wa, wb;
+    memcpy(&wa, a + i, 8);
+    memcpy(&wb, b + i, 8);
+
+    if (str_swar_case(wa, 0) != str_swar_case(wb, 0))
+      return 0;
+  }
+
+  for (; i < len; i++) {
+    if (str_ascii_lower((unsigned char)a[i]) !=
+        str_ascii_lower((unsigned char)b[i]))
+      return 0;
+  }
+
+  return 1;
+}
+
+/**
+ * byte at a time search, used for cpus without simd and the tails
+ * */
+static size_t str_find_scalar(const char *hay, size_t n, const char *needle,
+                              size_t m, int icase) {
+
+  if (m > n)
+    return -1;
+
+  size_t last = n - m;
+
+  if (!icase) {
+    const char *c = hay;
+    const char *c_end = hay + last;
+
+    // jump between occurences of the first byte
+    while (c <= c_end &&
+           (c = memchr(c, needle[0], (size_t)(c_end - c) + 1))) {
+      if (!memcmp(c + 1, needle + 1, m - 1))
+        return (size_t)(c - hay);
+      c++;
+    }
+
+    return -1;
+  }
+
+  unsigned char first = str_ascii_lower((unsigned char)needle[0]);
+  for (size_t i = 0; i <= last; i++) {
+    if (str_ascii_lower((unsigned char)hay[i]) == first &&
+        str_mem_equals(hay + i + 1, needle + 1, m - 1, 1))
+      return i;
+  }
+
+  return -1;
+}
+
+#ifdef STR_SIMD_X86
+
+/*
+ * the simd kernels compare a whole block against the first and the last byte
+ * of the needle, only positions where both match are verified
+ * */
+
+static size_t str_find_sse2(const char *hay, size_t n, const char *needle,
+                            size_t m, int icase) {
+
+  unsigned char f = (unsigned char)needle[0];
+  unsigned char l = (unsigned char)needle[m - 1];
+
+  const __m128i first_lo =
+      _mm_set1_epi8((char)(icase ? str_ascii_lower(f) : f));
+  const __m128i first_up =
+      _mm_set1_epi8((char)(icase ? str_ascii_upper(f) : f));
+  const __m128i last_lo = _mm_set1_epi8((char)(icase ? str_ascii_lower(l) : l));
+  const __m128i last_up = _mm_set1_epi8((char)(icase ? str_ascii_upper(l) : l));
+
+  size_t mid = m > 2 ? m - 2 : 0;
+
+  size_t i = 0;
+  for (; i + m - 1 + 16 <= n; i += 16) {
+    __m128i block_first = _mm_loadu_si128((const __m128i *)(hay + i));
+    __m128i block_last = _mm_loadu_si128((const __m128i *)(hay + i + m - 1));
+
+    __m128i eq_first = _mm_or_si128(_mm_cmpeq_epi8(block_first, first_lo),
+                                    _mm_cmpeq_epi8(block_first, first_up));
+    __m128i eq_last = _mm_or_si128(_mm_cmpeq_epi8(block_last, last_lo),
+                                   _mm_cmpeq_epi8(block_last, last_up));
+
+    unsigned int mask =
+        (unsigned int)_mm_movemask_epi8(_mm_and_si128(eq_first, eq_last));
+
+    while (mask) {
+      size_t bit = (size_t)__builtin_ctz(mask);
+
+      if (str_mem_equals(hay + i + bit + 1, needle + 1, mid, icase))
+        return i + bit;
+
+      mask &= mask - 1;
+    }
+  }
 
-  if (!*str_ptr(s) || !*str_ptr(delimiter)) {
-    *len = 1;
-    str_clone(*arr, s);
+  size_t pos = str_find_scalar(hay + i, n - i, needle, m, icase);
+
+  return pos == -1 ? pos : i + pos;
+}
+
+__attribute__((target("avx2"))) static size_t
+str_find_avx2(const char *hay, size_t n, const char *needle, size_t m,
+              int icase) {
+
+  unsigned char f = (unsigned char)needle[0];
+  unsigned char l = (unsigned char)needle[m - 1];
+
+  const __m256i first_lo =
+      _mm256_set1_epi8((char)(icase ? str_ascii_lower(f) : f));
+  const __m256i first_up =
+      _mm256_set1_epi8((char)(icase ? str_ascii_upper(f) : f));
+  const __m256i last_lo = _mm256_set1_epi8((char)(icase ? str_ascii_lower(l) : l));
+  const __m256i last_up = _mm256_set1_epi8((char)(icase ? str_ascii_upper(l) : l));
+
+  size_t mid = m > 2 ? m - 2 : 0;
+
+  size_t i = 0;
+  for (; i + m - 1 + 32 <= n; i += 32) {
+    __m256i block_first = _mm256_loadu_si256((const __m256i *)(hay + i));
+    __m256i block_last =
+        _mm256_loadu_si256((const __m256i *)(hay + i + m - 1));
+
+    __m256i eq_first =
+        _mm256_or_si256(_mm256_cmpeq_epi8(block_first, first_lo),
+                        _mm256_cmpeq_epi8(block_first, first_up));
+    __m256i eq_last = _mm256_or_si256(_mm256_cmpeq_epi8(block_last, last_lo),
+                                      _mm256_cmpeq_epi8(block_last, last_up));
+
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+        _mm256_and_si256(eq_first, eq_last));
+
+    while (mask) {
+      size_t bit = (size_t)__builtin_ctz(mask);
+
+      if (str_mem_equals(hay + i + bit + 1, needle + 1, mid, icase))
+        return i + bit;
+
+      mask &= mask - 1;
+    }
+  }
+
+  // less than a full block left, the sse2 kernel handles the rest
+  size_t pos = str_find_sse2(hay + i, n - i, needle, m, icase);
+
+  return pos == -1 ? pos : i + pos;
+}
+
+#endif
+
+/**
+ * picks the fastest search kernel the cpu supports
+ * */
+static str_find_fn str_find_select(void) {
+#ifdef STR_SIMD_X86
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2"))
+    return str_find_avx2;
+
+  return str_find_sse2;
+#else
+  return str_find_scalar;
+#endif
+}
+
+/**
+ * returns the position of the first occurence of needle (m > 0) in hay
+ * returns -1 if needle is not found
+ * */
+static size_t str_find(const char *hay, size_t n, const char *needle,
+                       size_t m, int icase) {
+  static str_find_fn kernel;
+
+  str_find_fn fn = __atomic_load_n(&kernel, __ATOMIC_RELAXED);
+
+  if (!fn) {
+    fn = str_find_select();
+    __atomic_store_n(&kernel, fn, __ATOMIC_RELAXED);
+  }
+
+  if (m > n)
+    return -1;
+
+  return fn(hay, n, needle, m, icase);
+}
+
+/**
+ * precompiles needle for repeated searches
+ *
+ * one byte needles use memchr, medium sized needles Horspool and long or
+ * periodic needles Two-Way, which is linear in the worst case
+ * */
+void str_searcher_init(str_searcher_t *searcher, const string_t needle) {
+
+  if (!searcher)
+    return;
+
+  str_clone(&searcher->needle, needle);
+
+  const unsigned char *x = (const unsigned char *)str_ptr(&searcher->needle);
+  size_t m = searcher->needle.len;
+
+  searcher->ell = 0;
+  searcher->period = 0;
+  searcher->periodic = 0;
+
+  if (m <= 1) {
+    searcher->algo = STR_SEARCH_MEMCHR;
+    return;
+  }
+
+  // critical factorization for Two-Way
+  size_t p, q;
+  ssize_t i = str_maxsuf(x, m, &p, 0);
+  ssize_t j = str_maxsuf(x, m, &q, 1);
+
+  searcher->ell = i > j ? i : j;
+  searcher->period = i > j ? p : q;
+  searcher->periodic =
+      !memcmp(x, x + searcher->period, (size_t)(searcher->ell + 1));
+
+  if (!searcher->periodic) {
+    size_t left = (size_t)(searcher->ell + 1);
+    size_t right = m - left;
+
+    searcher->period = (left > right ? left : right) + 1;
+  }
+
+  if (m > STR_SEARCH_HORSPOOL_MAX || searcher->periodic) {
+    searcher->algo = STR_SEARCH_TWOWAY;
+    return;
+  }
+
+  searcher->algo = STR_SEARCH_HORSPOOL;
+
+  // bad character shifts for the byte below the last needle position
+  for (int c = 0; c < 256; c++)
+    searcher->shift[c] = m;
+
+  for (size_t k = 0; k < m - 1; k++)
+    searcher->shift[x[k]] = m - 1 - k;
+}
+
+/**
+ * frees the needle copy of the searcher
+ * */
+void str_searcher_free(str_searcher_t *searcher) {
+
+  if (!searcher)
     return;
+
+  str_free(&searcher->needle);
+}
+
+/**
+ * returns the position of the first occurence of the needle in s
+ * returns -1 if the needle is not found
+ * */
+size_t str_searcher_find(const str_searcher_t *searcher, const string_t s) {
+
+  if (!searcher)
+    return -1;
+
+  const char *hay = str_ptr(&s);
+  const char *x = str_ptr(&searcher->needle);
+  size_t n = s.len;
+  size_t m = searcher->needle.len;
+
+  if (m == 0)
+    return 0;
+
+  if (m > n)
+    return -1;
+
+  switch (searcher->algo) {
+  case STR_SEARCH_MEMCHR: {
+    const char *c = memchr(hay, x[0], n);
+
+    return c ? (size_t)(c - hay) : (size_t)-1;
+  }
+  case STR_SEARCH_HORSPOOL: {
+    const unsigned char *y = (const unsigned char *)hay;
+    unsigned char last = (unsigned char)x[m - 1];
+
+    for (size_t j = 0; j <= n - m;) {
+      unsigned char c = y[j + m - 1];
+
+      if (c == last && !memcmp(hay + j, x, m - 1))
+        return j;
+
+      j += searcher->shift[c];
+    }
+
+    return -1;
+  }
+  default:
+    return str_twoway(searcher, hay, n);
   }
+}
+
+/**
+ * finds all non overlapping occurences of the needle in s
+ * arr has to be freed by the caller
+ * */
+void str_searcher_find_all(const str_searcher_t *searcher, const string_t s,
+                           size_t **arr, size_t *len) {
+
+  *arr = (size_t *)0;
+  *len = 0;
+
+  if (!searcher || !searcher->needle.len)
+    return;
+
+  size_t cap = 0;
+  size_t offset = 0;
+
+  // view of the not yet searched rest
+  string_t rest;
+  str_borrow(&rest, str_ptr(&s), s.len);
 
-  char *s_base = s.str;
-  size_t len_base = s.len;
   size_t pos;
-  while ((pos = str_pos(s, delimiter)) != -1) {
-    // delimiter is not at the very front
-    if (pos != 0) {
-      str_auto entry;
-      str_clone_from_chr(&entry, s.str, pos);
-      str_clone(*arr + *len, entry);
+  while ((pos = str_searcher_find(searcher, rest)) != -1) {
+
+    if (*len == cap) {
+      cap = cap ? cap * 2 : 16;
+
+      size_t *tmp = realloc(*arr, sizeof(size_t) * cap);
+      if (!tmp)
+        return;
+
+      *arr = tmp;
+    }
+
+    (*arr)[(*len)++] = offset + pos;
+
+    offset += pos + searcher->needle.len;
+    rest.str += pos + searcher->needle.len;
+    rest.len -= pos + searcher->needle.len;
+  }
+}
+
+/**
+ * returns the start of the maximal suffix of x, p is set to its period
+ * rev compares with the reversed alphabet order
+ * */
+static ssize_t str_maxsuf(const unsigned char *x, size_t m, size_t *p,
+                          int rev) {
+
+  ssize_t ms = -1;
+  size_t j = 0, k = 1;
+
+  *p = 1;
+
+  while (j + k < m) {
+    unsigned char a = x[j + k];
+    unsigned char b = x[(size_t)(ms + (ssize_t)k)];
+
+    if (rev ? a > b : a < b) {
+      j += k;
+      k = 1;
+      *p = j - (size_t)ms;
+    } else if (a == b) {
+      if (k != *p) {
+        k++;
+      } else {
+        j += *p;
+        k = 1;
+      }
     } else {
-      str_clone(*arr + *len, str_null);
+      ms = (ssize_t)j;
+      j = (size_t)ms + 1;
+      k = *p = 1;
     }
-    // advance the str pointer
-    s.str += pos + delimiter.len;
-    s.len -= pos + delimiter.len;
+  }
+
+  return ms;
+}
+
+/**
+ * Two-Way (Crochemore-Perrin) search, n >= needle length
+ * */
+static size_t str_twoway(const str_searcher_t *searcher, const char *hay,
+                         size_t n) {
+
+  const char *x = str_ptr(&searcher->needle);
+  size_t m = searcher->needle.len;
+  ssize_t ell = searcher->ell;
+  size_t per = searcher->period;
+
+  // prefix of the needle that is known to match after a periodic shift
+  ssize_t memory = -1;
+
+  for (size_t j = 0; j <= n - m;) {
+    ssize_t i = (ell > memory ? ell : memory) + 1;
+
+    // match the right part
+    while ((size_t)i < m && x[i] == hay[(size_t)i + j])
+      i++;
+
+    if ((size_t)i < m) {
+      j += (size_t)(i - ell);
+      memory = -1;
+      continue;
+    }
+
+    // match the left part
+    i = ell;
+    while (i > memory && x[i] == hay[(size_t)i + j])
+      i--;
+
+    if (i <= memory)
+      return j;
+
+    j += per;
+    memory = searcher->periodic ? (ssize_t)(m - per) - 1 : -1;
+  }
+
+  return -1;
+}
+
+/**
+ * splits the given string into an array of strings
+ * */
+void str_explode(string_t s, const string_t delimiter, string_t **arr,
+                 size_t *len) {
+
+  str_explode_view(&s, delimiter, arr, len);
+
+  // turn the slices into copies
+  for (size_t i = 0; i < *len; i++)
+    str_clone(*arr + i, (*arr)[i]);
+}
+
+/**
+ * splits the given string into borrowed slices of s, only the array is
+ * allocated
+ * the slices are valid as long as s is not modified, moved or freed
+ * */
+void str_explode_view(const string_t *s, const string_t delimiter,
+                      string_t **arr, size_t *len) {
+
+  size_t cap = 8;
+
+  *arr = malloc(sizeof(string_t) * cap);
+  *len = 0;
+
+  if (!*arr || !s)
+    return;
+
+  // view of the not yet exploded rest
+  string_t rest;
+  str_borrow(&rest, str_ptr(s), s->len);
+
+  size_t pos;
+  while (delimiter.len && (pos = str_pos(rest, delimiter)) != -1) {
+
+    // keep room for the rest
+    if (*len + 1 == cap) {
+      string_t *tmp = realloc(*arr, sizeof(string_t) * cap * 2);
+      if (!tmp)
+        return;
+
+      *arr = tmp;
+      cap *= 2;
+    }
+
+    str_borrow(*arr + (*len)++, rest.str, pos);
+
+    // advance the str pointer
+    rest.str += pos + delimiter.len;
+    rest.len -= pos + delimiter.len;
+  }
+
+  (*arr)[(*len)++] = rest;
+}
+
+/**
+ * splits the given string into at most cap borrowed slices of s stored in
+ * arr, the last slice holds the unsplit rest if there are more
+ * returns the number of slices, nothing is allocated
+ * */
+size_t str_explode_into(const string_t *s, const string_t delimiter,
+                        string_t *arr, size_t cap) {
+
+  if (!s || !arr || !cap)
+    return 0;
+
+  size_t len = 0;
+
+  // view of the not yet exploded rest
+  string_t rest;
+  str_borrow(&rest, str_ptr(s), s->len);
+
+  size_t pos;
+  while (len + 1 < cap && delimiter.len &&
+         (pos = str_pos(rest, delimiter)) != -1) {
+    str_borrow(arr + len++, rest.str, pos);
+
+    // advance the str pointer
+    rest.str += pos + delimiter.len;
+    rest.len -= pos + delimiter.len;
+  }
+
+  arr[len++] = rest;
+
+  return len;
+}
+
+/**
+ * joins an array of strings into a string
+ * */
+string_t str_implode(const string_t delimiter, string_t *arr, size_t len) {
+  string_t s = str_null;
+
+  strr_implode(&s, delimiter, arr, len);
+
+  return s;
+}
+
+/**
+ * appends the joined array of strings to the string
+ * the final length is summed up first, so there is at most one allocation
+ * */
+string_t *strr_implode(string_t *s, const string_t delimiter, string_t *arr,
+                       size_t len) {
+
+  if (!s)
+    return s;
+
+  if (len == 0)
+    return s;
+
+  size_t total = s->len + (len - 1) * delimiter.len;
+  for (size_t i = 0; i < len; i++)
+    total += arr[i].len;
+
+  // the elements may point into s, so it is only written in place when its
+  // buffer doesn't have to move
+  string_t s_new = *s;
+  char *c;
+
+  int in_place =
+      (s->flags & STR_HEAP && s->flags & STR_OWNER && total <= s->cap) ||
+      (s->flags & STR_SSO && total <= STR_SSO_CAP);
+
+  if (in_place) {
+    c = str_ptr(s);
+  } else {
+    c = str_init_len(&s_new, total);
+
+    if (!c)
+      return s;
+
+    memcpy(c, str_ptr(s), s->len);
+  }
+
+  const char *d = str_ptr(&delimiter);
+  char *out = c + s->len;
+
+  for (size_t i = 0; i < len; i++) {
+    if (i) {
+      memcpy(out, d, delimiter.len);
+      out += delimiter.len;
+    }
+
+    memcpy(out, str_ptr(&arr[i]), arr[i].len);
+    out += arr[i].len;
+  }
+
+  *(c + total) = 0;
+
+  if (in_place) {
+    s->len = total;
+    return s;
+  }
+
+  str_free(s);
+  *s = s_new;
+
+  return s;
+}
+
+/**
+ * describes the joined array of strings as iovecs for writev, nothing is
+ * copied, iov points into delimiter and the elements (or their inline chars)
+ * empty pieces are left out, so at most 2 * len - 1 entries are used
+ * returns the number of entries filled, the join is cut off after cap
+ * */
+size_t str_implode_iov(const string_t *delimiter, const string_t *arr,
+                       size_t len, struct iovec *iov, size_t cap) {
+
+  if (!delimiter || !arr || !iov)
+    return 0;
+
+  size_t n = 0;
+
+  for (size_t i = 0; i < len && n < cap; i++) {
+    if (i && delimiter->len) {
+      iov[n].iov_base = str_ptr(delimiter);
+      iov[n++].iov_len = delimiter->len;
+
+      if (n == cap)
+        break;
+    }
+
+    if (arr[i].len) {
+      iov[n].iov_base = str_ptr(&arr[i]);
+      iov[n++].iov_len = arr[i].len;
+    }
+  }
+
+  return n;
+}
+
+/**
+ * sorts the strings in byte order (like memcmp, a prefix comes first)
+ *
+ * multikey quicksort on cached 8 byte keys, each partitioning step compares
+ * 7 bytes at once without touching the chars, the elements are moved in
+ * place at the end
+ * */
+void str_sort(string_t *arr, size_t len) {
+
+  if (!arr || len < 2)
+    return;
+
+  str_sort_item_t *items = str_sort_items(arr, len);
+
+  if (!items) {
+    qsort(arr, len, sizeof(string_t), str_sort_cmp);
+    return;
+  }
+
+  str_sort_mkqs(items, len, arr, 0);
+  str_sort_permute(arr, items, len);
+
+  free(items);
+}
+
+static inline uint64_t str_sort_key(const string_t *s, size_t depth) {
+
+  const unsigned char *c = (const unsigned char *)str_ptr(s) + depth;
+  size_t rem = s->len - depth;
+
+#ifdef STR_SWAR_LE
+  if (rem >= 8) {
+    uint64_t w;
+    memcpy(&w, c, 8);
+
+    return (__builtin_bswap64(w) & ~(uint64_t)0xff) | 8;
+  }
+#endif
+
+  uint64_t key = rem < 8 ? rem : 8;
+
+  for (size_t i = 0; i < 7 && i < rem; i++)
+    key |= (uint64_t)c[i] << (56 - 8 * i);
+
+  return key;
+}
+
+/**
+ * the items of arr with their keys at depth 0
+ * */
+static str_sort_item_t *str_sort_items(const string_t *arr, size_t len) {
+
+  str_sort_item_t *items = malloc(len * sizeof(str_sort_item_t));
+
+  if (!items)
+    return (str_sort_item_t *)0;
+
+  for (size_t i = 0; i < len; i++) {
+    items[i].key = str_sort_key(arr + i, 0);
+    items[i].index = i;
+  }
+
+  return items;
+}
+
+/**
+ * sorts items whose strings share depth bytes, the keys are at depth
+ * */
+static void str_sort_mkqs(str_sort_item_t *items, size_t n,
+                          const string_t *arr, size_t depth) {
+
+  while (n >= STR_SORT_INSERTION) {
+    uint64_t a = items[0].key, b = items[n / 2].key, c = items[n - 1].key;
+    uint64_t pivot = a < b ? (b < c ? b : (a < c ? c : a))
+                           : (a < c ? a : (b < c ? c : b));
+
+    // [0, lt) < pivot, [lt, gt) == pivot, [gt, n) > pivot
+    size_t lt = 0, i = 0, gt = n;
+
+    while (i < gt) {
+      str_sort_item_t t = items[i];
+
+      if (t.key < pivot) {
+        items[i++] = items[lt];
+        items[lt++] = t;
+      } else if (t.key > pivot) {
+        items[i] = items[--gt];
+        items[gt] = t;
+      } else {
+        i++;
+      }
+    }
+
+    // equal keys with less than 8 remaining bytes are equal strings
+    size_t eq = (pivot & 0xff) == 8 ? gt - lt : 0;
+
+    if (eq) {
+      for (size_t j = lt; j < gt; j++)
+        items[j].key = str_sort_key(arr + items[j].index, depth + 7);
+    }
+
+    // recurse on the smaller parts and continue with the largest one
+    if (eq >= lt && eq >= n - gt) {
+      str_sort_mkqs(items, lt, arr, depth);
+      str_sort_mkqs(items + gt, n - gt, arr, depth);
+
+      items += lt;
+      n = eq;
+      depth += 7;
+    } else if (lt >= n - gt) {
+      str_sort_mkqs(items + gt, n - gt, arr, depth);
+      str_sort_mkqs(items + lt, eq, arr, depth + 7);
+
+      n = lt;
+    } else {
+      str_sort_mkqs(items, lt, arr, depth);
+      str_sort_mkqs(items + lt, eq, arr, depth + 7);
+
+      items += gt;
+      n -= gt;
+    }
+  }
+
+  str_sort_insertion(items, n, arr, depth);
+}
+
+/**
+ * insertion sort for small partitions, equal keys are resolved by comparing
+ * the rest of the strings
+ * */
+static void str_sort_insertion(str_sort_item_t *items, size_t n,
+                               const string_t *arr, size_t depth) {
+
+  for (size_t i = 1; i < n; i++) {
+    str_sort_item_t t = items[i];
+    size_t j = i;
+
+    while (j > 0) {
+      const str_sort_item_t *prev = items + j - 1;
+
+      if (prev->key < t.key)
+        break;
+
+      if (prev->key == t.key) {
+        if ((t.key & 0xff) < 8 ||
+            str_sort_cmp_at(arr + prev->index, arr + t.index, depth + 7) <= 0)
+          break;
+      }
+
+      items[j] = items[j - 1];
+      j--;
+    }
+
+    items[j] = t;
+  }
+}
+
+/**
+ * moves the strings to the order of items, following the cycles of the
+ * permutation so no second array is needed
+ * */
+static void str_sort_permute(string_t *arr, str_sort_item_t *items,
+                             size_t len) {
+
+  for (size_t i = 0; i < len; i++) {
+    if (items[i].index == i)
+      continue;
+
+    string_t tmp = arr[i];
+    size_t j = i;
+
+    while (items[j].index != i) {
+      size_t k = items[j].index;
+
+      arr[j] = arr[k];
+      items[j].index = j;
+      j = k;
+    }
+
+    arr[j] = tmp;
+    items[j].index = j;
+  }
+}
+
+/**
+ * byte order of two strings that share their first depth bytes
+ * */
+static int str_sort_cmp_at(const string_t *s1, const string_t *s2,
+                           size_t depth) {
+
+  size_t n = s1->len < s2->len ? s1->len : s2->len;
+
+  int r = n > depth ? memcmp(str_ptr(s1) + depth, str_ptr(s2) + depth,
+                             n - depth)
+                    : 0;
+
+  if (r)
+    return r;
+
+  return (s1->len > s2->len) - (s1->len < s2->len);
+}
+
+/**
+ * byte order of two string_t, for qsort
+ * */
+static int str_sort_cmp(const void *a, const void *b) {
+  return str_sort_cmp_at(a, b, 0);
+}
+
+/**
+ * builds a dictionary of the strings in arr, which have to be sorted in byte
+ * order (see str_sort) and unique, the id of a string is its index in arr
+ * returns 0 if arr is not sorted or the allocation failed
+ * */
+int str_dict_build(str_dict_t *dict, const string_t *arr, size_t len) {
+
+  if (!dict || (!arr && len))
+    return 0;
+
+  *dict = (str_dict_t){0};
+
+  // the encoded size first, so data is allocated once
+  size_t size = 0, max_len = 0;
+
+  for (size_t i = 0; i < len; i++) {
+    const string_t *cur = arr + i;
+    size_t shared = 0;
+
+    if (i && str_sort_cmp_at(arr + i - 1, cur, 0) >= 0)
+      return 0;
+
+    if (i % STR_DICT_BLOCK) {
+      const char *a = str_ptr(&arr[i - 1]), *b = str_ptr(cur);
+      size_t n = arr[i - 1].len < cur->len ? arr[i - 1].len : cur->len;
+
+      while (shared < n && a[shared] == b[shared])
+        shared++;
+
+      size += str_varint_len(shared);
+    }
+
+    size += str_varint_len(cur->len - shared) + cur->len - shared;
+
+    if (cur->len > max_len)
+      max_len = cur->len;
+  }
+
+  size_t nblocks = (len + STR_DICT_BLOCK - 1) / STR_DICT_BLOCK;
+
+  dict->data = malloc(size ? size : 1);
+  dict->blocks = malloc((nblocks ? nblocks : 1) * sizeof(size_t));
+
+  if (!dict->data || !dict->blocks) {
+    str_dict_free(dict);
+    return 0;
+  }
+
+  unsigned char *p = dict->data;
+
+  for (size_t i = 0; i < len; i++) {
+    const char *c = str_ptr(&arr[i]);
+    size_t shared = 0;
+
+    if (i % STR_DICT_BLOCK) {
+      const char *a = str_ptr(&arr[i - 1]);
+      size_t n = arr[i - 1].len < arr[i].len ? arr[i - 1].len : arr[i].len;
+
+      while (shared < n && a[shared] == c[shared])
+        shared++;
+
+      p = str_varint_put(p, shared);
+    } else {
+      dict->blocks[i / STR_DICT_BLOCK] = (size_t)(p - dict->data);
+    }
+
+    p = str_varint_put(p, arr[i].len - shared);
+    memcpy(p, c + shared, arr[i].len - shared);
+    p += arr[i].len - shared;
+  }
+
+  dict->len = len;
+  dict->max_len = max_len;
+
+  return 1;
+}
+
+void str_dict_free(str_dict_t *dict) {
+
+  if (!dict)
+    return;
+
+  free(dict->data);
+  free(dict->blocks);
+
+  *dict = (str_dict_t){0};
+}
+
+/**
+ * returns the id of key or -1
+ * */
+size_t str_dict_find(const str_dict_t *dict, const string_t key) {
+
+  if (!dict)
+    return -1;
+
+  int found = 0;
+  size_t id = str_dict_lower(dict, str_ptr(&key), key.len, &found);
+
+  return found ? id : (size_t)-1;
+}
+
+/**
+ * returns a copy of the string with the given id, str_null if there is none
+ * */
+string_t str_dict_get(const str_dict_t *dict, size_t id) {
+
+  if (!dict || id >= dict->len)
+    return str_null;
+
+  const unsigned char *start = dict->data + dict->blocks[id / STR_DICT_BLOCK];
+  size_t steps = id % STR_DICT_BLOCK;
+
+  // the length first, then the chars of all strings up to id, later ones
+  // overwrite the shared prefix
+  const unsigned char *p = start;
+  size_t len = 0;
+
+  for (size_t i = 0; i <= steps; i++) {
+    size_t shared = 0, rest;
+
+    if (i)
+      p = str_varint_get(p, &shared);
+
+    p = str_varint_get(p, &rest);
+    p += rest;
+    len = shared + rest;
+  }
+
+  string_t s;
+  char *c = str_init_len(&s, len);
+
+  if (!c)
+    return str_null;
+
+  p = start;
+
+  for (size_t i = 0; i <= steps; i++) {
+    size_t shared = 0, rest;
+
+    if (i)
+      p = str_varint_get(p, &shared);
+
+    p = str_varint_get(p, &rest);
+
+    if (shared < len)
+      memcpy(c + shared, p, shared + rest < len ? rest : len - shared);
+
+    p += rest;
+  }
+
+  return s;
+}
+
+/**
+ * iterates over the strings starting with prefix in order, str_null
+ * iterates over all of them
+ * returns 0 if the allocation failed
+ * */
+int str_dict_iter(const str_dict_t *dict, const string_t prefix,
+                  str_dict_iter_t *it) {
+
+  if (!dict || !it)
+    return 0;
+
+  *it = (str_dict_iter_t){0};
+  it->dict = dict;
+  it->buf = malloc(dict->max_len + 1);
+
+  if (!it->buf)
+    return 0;
+
+  int found;
+  size_t start = str_dict_lower(dict, str_ptr(&prefix), prefix.len, &found);
+  size_t end = dict->len;
+
+  // the range ends before the first string greater than all with the prefix,
+  // i.e. the prefix with its last byte below 0xff incremented
+  if (prefix.len <= dict->max_len) {
+    size_t n = prefix.len;
+
+    memcpy(it->buf, str_ptr(&prefix), n);
+
+    while (n && (unsigned char)it->buf[n - 1] == 0xff)
+      n--;
+
+    if (n) {
+      it->buf[n - 1]++;
+      end = str_dict_lower(dict, it->buf, n, &found);
+    }
+  } else {
+    start = end;
+  }
+
+  it->end = end;
+
+  if (start >= end) {
+    it->id = end;
+    return 1;
+  }
+
+  // decode the block up to start
+  it->id = start - start % STR_DICT_BLOCK;
+  it->p = dict->data + dict->blocks[start / STR_DICT_BLOCK];
+
+  while (it->id < start)
+    str_dict_decode(it);
+
+  return 1;
+}
+
+/**
+ * sets s to the next string, a view that stays valid until the next call
+ * returns 0 at the end of the range
+ * */
+int str_dict_next(str_dict_iter_t *it, string_t *s) {
+
+  if (!it || it->id >= it->end)
+    return 0;
+
+  str_dict_decode(it);
+
+  if (s)
+    str_borrow(s, it->buf, it->len);
+
+  return 1;
+}
+
+void str_dict_iter_free(str_dict_iter_t *it) {
+
+  if (!it)
+    return;
+
+  free(it->buf);
+
+  *it = (str_dict_iter_t){0};
+}
+
+static size_t str_varint_len(size_t v) {
+
+  size_t n = 1;
+
+  while (v >= 0x80) {
+    v >>= 7;
+    n++;
+  }
+
+  return n;
+}
+
+static unsigned char *str_varint_put(unsigned char *p, size_t v) {
+
+  while (v >= 0x80) {
+    *p++ = (unsigned char)(v | 0x80);
+    v >>= 7;
+  }
+
+  *p++ = (unsigned char)v;
+
+  return p;
+}
+
+static const unsigned char *str_varint_get(const unsigned char *p, size_t *v) {
+
+  size_t value = 0;
+  int shift = 0;
+
+  while (*p & 0x80) {
+    value |= (size_t)(*p++ & 0x7f) << shift;
+    shift += 7;
+  }
+
+  *v = value | (size_t)*p++ << shift;
+
+  return p;
+}
+
+/**
+ * id of the first string >= key, found is set if it is equal to key
+ *
+ * binary search over the first strings of the blocks, then a scan of the
+ * block that only compares the chars after the prefix the previous string
+ * already had in common with key
+ * */
+static size_t str_dict_lower(const str_dict_t *dict, const char *key,
+                             size_t len, int *found) {
+
+  *found = 0;
+
+  size_t nblocks = (dict->len + STR_DICT_BLOCK - 1) / STR_DICT_BLOCK;
+  size_t lo = 0, hi = nblocks;
+
+  // first block whose first string is greater than key
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    const unsigned char *p = dict->data + dict->blocks[mid];
+    size_t n;
+
+    p = str_varint_get(p, &n);
+
+    size_t min = n < len ? n : len;
+    int r = min ? memcmp(p, key, min) : 0;
+
+    if (r < 0 || (!r && n <= len))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (!lo)
+    return 0;
+
+  size_t block = lo - 1;
+  size_t id = block * STR_DICT_BLOCK;
+  size_t end =
+      id + STR_DICT_BLOCK < dict->len ? id + STR_DICT_BLOCK : dict->len;
+  const unsigned char *p = dict->data + dict->blocks[block];
+
+  // matched: chars the current string has in common with key, the current
+  // string is always less than key here
+  size_t cur_len, matched = 0;
+  p = str_varint_get(p, &cur_len);
+
+  while (matched < cur_len && matched < len &&
+         (unsigned char)p[matched] == (unsigned char)key[matched])
+    matched++;
+
+  if (matched == cur_len && matched == len) {
+    *found = 1;
+    return id;
+  }
+
+  p += cur_len;
+
+  for (id++; id < end; id++) {
+    size_t shared, rest;
+
+    p = str_varint_get(p, &shared);
+    p = str_varint_get(p, &rest);
+
+    // differs from the previous string where that one still matched key,
+    // so it is greater
+    if (shared < matched)
+      return id;
+
+    // keeps the part of the previous string that was less than key
+    if (shared > matched) {
+      p += rest;
+      continue;
+    }
+
+    size_t i = 0;
+
+    while (i < rest && matched + i < len &&
+           p[i] == (unsigned char)key[matched + i])
+      i++;
+
+    matched += i;
+    cur_len = shared + rest;
+
+    if (matched == len) {
+      *found = matched == cur_len;
+      return id;
+    }
+
+    if (i < rest && p[i] > (unsigned char)key[matched])
+      return id;
+
+    p += rest;
+  }
+
+  return id;
+}
+
+/**
+ * decodes the string at it->p into it->buf and advances to the next one
+ * */
+static void str_dict_decode(str_dict_iter_t *it) {
+
+  size_t shared = 0, rest;
+
+  if (it->id % STR_DICT_BLOCK)
+    it->p = str_varint_get(it->p, &shared);
+  else
+    it->p = it->dict->data + it->dict->blocks[it->id / STR_DICT_BLOCK];
+
+  it->p = str_varint_get(it->p, &rest);
+
+  memcpy(it->buf + shared, it->p, rest);
+
+  it->p += rest;
+  it->len = shared + rest;
+  it->id++;
+}
+
+/**
+ * builds the suffix array of text with SA-IS in O(n), *text has to outlive
+ * the index (the chars of inline strings are stored in the string_t)
+ * returns 0 if the allocation failed
+ * */
+int str_index_build(str_index_t *index, const string_t *text) {
+
+  if (!index || !text)
+    return 0;
+
+  *index = (str_index_t){0};
+
+  if (text->len > SIZE_MAX / sizeof(size_t))
+    return 0;
+
+  size_t *sa = malloc((text->len ? text->len : 1) * sizeof(size_t));
+
+  if (!sa || !str_sais(str_ptr(text), 1, sa, text->len, 256)) {
+    free(sa);
+    return 0;
+  }
+
+  index->text = str_ptr(text);
+  index->len = text->len;
+  index->sa = sa;
+  index->owned = 1;
+
+  return 1;
+}
+
+void str_index_free(str_index_t *index) {
+
+  if (!index)
+    return;
+
+  if (index->owned)
+    free((size_t *)index->sa);
+
+  *index = (str_index_t){0};
+}
+
+/**
+ * counts the (possibly overlapping) occurrences of search in O(m log n)
+ * */
+size_t str_index_count(const str_index_t *index, const string_t search) {
+
+  if (!index || !search.len)
+    return 0;
+
+  size_t lo, hi;
+  str_index_range(index, str_ptr(&search), search.len, &lo, &hi);
+
+  return hi - lo;
+}
+
+/**
+ * stores up to cap positions of search in pos, in no particular order
+ * returns the number of occurrences, which may be larger than cap
+ * */
+size_t str_index_locate(const str_index_t *index, const string_t search,
+                        size_t *pos, size_t cap) {
+
+  if (!index || !search.len)
+    return 0;
+
+  size_t lo, hi;
+  str_index_range(index, str_ptr(&search), search.len, &lo, &hi);
+
+  for (size_t i = lo; pos && i < hi && i - lo < cap; i++)
+    pos[i - lo] = index->sa[i];
+
+  return hi - lo;
+}
+
+/**
+ * first position of search like str_pos, or -1
+ * */
+size_t str_index_pos(const str_index_t *index, const string_t search) {
+
+  if (!index || !search.len)
+    return -1;
+
+  size_t lo, hi;
+  str_index_range(index, str_ptr(&search), search.len, &lo, &hi);
+
+  size_t pos = -1;
+
+  for (size_t i = lo; i < hi; i++) {
+    if (index->sa[i] < pos)
+      pos = index->sa[i];
+  }
+
+  return pos;
+}
+
+/**
+ * writes the index (header and suffix array, not the text) to fd
+ * the file can be mapped and passed to str_index_load together with the text
+ * returns 0 if writing failed
+ * */
+int str_index_save(const str_index_t *index, int fd) {
+
+  if (!index)
+    return 0;
+
+  string_t text;
+  str_borrow(&text, index->text, index->len);
+
+  str_index_header_t header = {.magic = STR_INDEX_MAGIC,
+                               .len = (uint64_t)index->len,
+                               .hash = str_hash(text, 0),
+                               .order = STR_INDEX_ORDER,
+                               .width = (uint32_t)sizeof(size_t)};
+
+  const char *data[2] = {(const char *)&header, (const char *)index->sa};
+  size_t size[2] = {sizeof(header), index->len * sizeof(size_t)};
+
+  for (int i = 0; i < 2; i++) {
+    while (size[i]) {
+      ssize_t w = write(fd, data[i], size[i]);
+
+      if (w < 0 && errno == EINTR)
+        continue;
+
+      if (w <= 0)
+        return 0;
+
+      data[i] += w;
+      size[i] -= (size_t)w;
+    }
+  }
+
+  return 1;
+}
+
+/**
+ * uses an index written by str_index_save, e.g. mapped with mmap, nothing is
+ * copied so data and *text have to outlive the index, data has to be aligned
+ * for size_t
+ *
+ * the file is validated in O(n): a file of another text (by length and
+ * hash), another platform (size_t width, byte order), a truncated file or a
+ * suffix array entry outside of the text is rejected, so no file makes the
+ * index read out of bounds
+ * returns 0 if data is no valid index of text
+ * */
+int str_index_load(str_index_t *index, const string_t *text, const void *data,
+                   size_t size) {
+
+  if (!index || !text || !data)
+    return 0;
+
+  *index = (str_index_t){0};
+
+  str_index_header_t header;
+
+  if (size < sizeof(header) || text->len > SIZE_MAX / sizeof(size_t))
+    return 0;
+
+  memcpy(&header, data, sizeof(header));
+
+  if (memcmp(header.magic, STR_INDEX_MAGIC, sizeof(header.magic)) ||
+      header.order != STR_INDEX_ORDER || header.width != sizeof(size_t) ||
+      header.len != text->len ||
+      size - sizeof(header) < text->len * sizeof(size_t))
+    return 0;
+
+  const size_t *sa = (const size_t *)((const char *)data + sizeof(header));
+
+  if ((uintptr_t)sa % sizeof(size_t) || header.hash != str_hash(*text, 0))
+    return 0;
+
+  for (size_t i = 0; i < text->len; i++) {
+    if (sa[i] >= text->len)
+      return 0;
+  }
+
+  index->text = str_ptr(text);
+  index->len = text->len;
+  index->sa = sa;
+
+  return 1;
+}
+
+#define STR_SAIS_EMPTY ((size_t)-1)
+#define STR_SAIS_CHR(t, width, i)                                              \
+  ((width) == 1 ? (size_t)((const unsigned char *)(t))[i]                      \
+                : ((const size_t *)(t))[i])
+
+/*
+ * SA-IS (Nong, Zhang, Chan) with a virtual sentinel behind the text that is
+ * smaller than every char, so the text needs no terminator
+ *
+ * t has n chars of width 1 (bytes) or sizeof(size_t) (the reduced strings of
+ * the recursion) in [0, k), sa has room for n entries
+ * */
+static int str_sais(const void *t, int width, size_t *sa, size_t n,
+                    size_t k) {
+
+  if (n == 0)
+    return 1;
+
+  if (n == 1) {
+    sa[0] = 0;
+    return 1;
+  }
+
+  // S (1) or L (0) suffix, the last char is L as the sentinel follows it
+  char *type = malloc(n);
+  size_t *bucket = malloc(k * sizeof(size_t));
+
+  if (!type || !bucket) {
+    free(type);
+    free(bucket);
+    return 0;
+  }
+
+  type[n - 1] = 0;
+  for (size_t i = n - 1; i-- > 0;) {
+    size_t a = STR_SAIS_CHR(t, width, i), b = STR_SAIS_CHR(t, width, i + 1);
+    type[i] = a < b || (a == b && type[i + 1]);
+  }
+
+#define STR_SAIS_LMS(i) ((i) > 0 && type[i] && !type[(i)-1])
+
+  // sort the LMS substrings by inducing from the LMS positions
+  str_sais_buckets(t, width, n, k, bucket, 1);
+
+  for (size_t i = 0; i < n; i++)
+    sa[i] = STR_SAIS_EMPTY;
+
+  for (size_t i = 1; i < n; i++) {
+    if (STR_SAIS_LMS(i))
+      sa[--bucket[STR_SAIS_CHR(t, width, i)]] = i;
+  }
+
+  str_sais_induce(t, width, type, sa, n, k, bucket);
+
+  // the sorted LMS positions to the front
+  size_t m = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (STR_SAIS_LMS(sa[i]))
+      sa[m++] = sa[i];
+  }
+
+  // name the LMS substrings, equal substrings get equal names, the names are
+  // stored at m + pos / 2 as LMS positions are at least 2 apart
+  for (size_t i = m; i < n; i++)
+    sa[i] = STR_SAIS_EMPTY;
+
+  size_t names = 0, prev = STR_SAIS_EMPTY;
+
+  for (size_t i = 0; i < m; i++) {
+    size_t pos = sa[i];
+    int diff = prev == STR_SAIS_EMPTY;
+
+    for (size_t d = 0; !diff; d++) {
+      // the substring ending at the sentinel equals no other one
+      if (pos + d == n || prev + d == n ||
+          STR_SAIS_CHR(t, width, pos + d) !=
+              STR_SAIS_CHR(t, width, prev + d) ||
+          type[pos + d] != type[prev + d]) {
+        diff = 1;
+      } else if (d > 0 && (STR_SAIS_LMS(pos + d) || STR_SAIS_LMS(prev + d))) {
+        break;
+      }
+    }
+
+    if (diff)
+      names++;
+
+    prev = pos;
+    sa[m + pos / 2] = names - 1;
+  }
+
+  // the reduced string (names in text order) to the end of sa
+  for (size_t i = n, j = n; i-- > m;) {
+    if (sa[i] != STR_SAIS_EMPTY)
+      sa[--j] = sa[i];
+  }
+
+  size_t *s1 = sa + n - m;
+  int ok = 1;
+
+  if (names < m) {
+    ok = str_sais(s1, (int)sizeof(size_t), sa, m, names);
+  } else {
+    for (size_t i = 0; i < m; i++)
+      sa[s1[i]] = i;
+  }
+
+  if (ok) {
+    // s1 becomes the LMS positions in text order, sa[0, m) the sorted ones
+    for (size_t i = 1, j = 0; i < n; i++) {
+      if (STR_SAIS_LMS(i))
+        s1[j++] = i;
+    }
+
+    for (size_t i = 0; i < m; i++)
+      sa[i] = s1[sa[i]];
+
+    for (size_t i = m; i < n; i++)
+      sa[i] = STR_SAIS_EMPTY;
+
+    // the sorted LMS suffixes to the ends of their buckets, then induce
+    str_sais_buckets(t, width, n, k, bucket, 1);
+
+    for (size_t i = m; i-- > 0;) {
+      size_t j = sa[i];
+      sa[i] = STR_SAIS_EMPTY;
+      sa[--bucket[STR_SAIS_CHR(t, width, j)]] = j;
+    }
+
+    str_sais_induce(t, width, type, sa, n, k, bucket);
+  }
+
+#undef STR_SAIS_LMS
+
+  free(type);
+  free(bucket);
+
+  return ok;
+}
+
+/**
+ * start (end = 0) or end (end = 1) of each char's bucket
+ * */
+static void str_sais_buckets(const void *t, int width, size_t n, size_t k,
+                             size_t *bucket, int end) {
+
+  memset(bucket, 0, k * sizeof(size_t));
+
+  for (size_t i = 0; i < n; i++)
+    bucket[STR_SAIS_CHR(t, width, i)]++;
+
+  size_t sum = 0;
+
+  for (size_t i = 0; i < k; i++) {
+    sum += bucket[i];
+    bucket[i] = end ? sum : sum - bucket[i];
+  }
+}
+
+/**
+ * induces the L suffixes from the S ones placed in sa and then the S
+ * suffixes from the L ones
+ * */
+static void str_sais_induce(const void *t, int width, const char *type,
+                            size_t *sa, size_t n, size_t k, size_t *bucket) {
+
+  str_sais_buckets(t, width, n, k, bucket, 0);
+
+  // the sentinel comes first, n - 1 is the L suffix before it
+  sa[bucket[STR_SAIS_CHR(t, width, n - 1)]++] = n - 1;
+
+  for (size_t i = 0; i < n; i++) {
+    size_t j = sa[i] - 1;
+
+    if (sa[i] != STR_SAIS_EMPTY && sa[i] > 0 && !type[j])
+      sa[bucket[STR_SAIS_CHR(t, width, j)]++] = j;
+  }
+
+  str_sais_buckets(t, width, n, k, bucket, 1);
+
+  for (size_t i = n; i-- > 0;) {
+    size_t j = sa[i] - 1;
+
+    if (sa[i] != STR_SAIS_EMPTY && sa[i] > 0 && type[j])
+      sa[--bucket[STR_SAIS_CHR(t, width, j)]] = j;
+  }
+}
+
+/**
+ * compares the suffix with the pattern c from lcp on, lcp is advanced over
+ * the matching chars
+ * returns < 0 if the suffix is smaller, 0 if it starts with the pattern and
+ * > 0 if it is greater
+ * */
+static int str_index_cmp(const str_index_t *index, size_t suffix,
+                         const char *c, size_t m, size_t *lcp) {
+
+  const unsigned char *text = (const unsigned char *)index->text + suffix;
+  size_t n = index->len - suffix;
+  size_t i = *lcp;
+
+  while (i < m && i < n && text[i] == (unsigned char)c[i])
+    i++;
+
+  *lcp = i;
+
+  if (i == m)
+    return 0;
+
+  if (i == n)
+    return -1;
+
+  return text[i] < (unsigned char)c[i] ? -1 : 1;
+}
+
+/**
+ * the suffixes starting with c are sa[lo, hi)
+ *
+ * binary searches that skip the chars shared by both bounds of the search
+ * interval, which all suffixes in between have in common with c as well
+ * */
+static void str_index_range(const str_index_t *index, const char *c, size_t m,
+                            size_t *lo, size_t *hi) {
+
+  for (int upper = 0; upper < 2; upper++) {
+    size_t l = upper ? *lo : 0, r = index->len;
+    size_t l_lcp = 0, r_lcp = 0;
+
+    while (l < r) {
+      size_t mid = l + (r - l) / 2;
+      size_t lcp = l_lcp < r_lcp ? l_lcp : r_lcp;
+      int cmp = str_index_cmp(index, index->sa[mid], c, m, &lcp);
+
+      // lower bound: first suffix >= c, upper bound: first one > c
+      if (cmp < 0 || (upper && !cmp)) {
+        l = mid + 1;
+        l_lcp = lcp;
+      } else {
+        r = mid;
+        r_lcp = lcp;
+      }
+    }
+
+    *(upper ? hi : lo) = l;
+  }
+}
+
+/**
+ * levenshtein distance of the strings (insert, delete and replace cost 1)
+ *
+ * bit-parallel over the shorter string, O(n * m / 64)
+ * returns -1 if memory for strings over 64 bytes could not be allocated
+ * */
+size_t str_edit_distance(const string_t s1, const string_t s2) {
+  return str_edit_distance_bounded(s1, s2, -1);
+}
+
+/**
+ * str_edit_distance that stops as soon as the distance has to exceed max
+ * returns -1 if it does
+ * */
+size_t str_edit_distance_bounded(const string_t s1, const string_t s2,
+                                 size_t max) {
+
+  const string_t *a = s1.len <= s2.len ? &s1 : &s2;
+  const string_t *b = s1.len <= s2.len ? &s2 : &s1;
+
+  if (b->len - a->len > max)
+    return -1;
+
+  str_myers_t my;
+
+  if (!str_myers_init(&my, str_ptr(a), a->len, 0))
+    return -1;
+
+  size_t dist = str_myers_distance(&my, str_ptr(b), b->len, max);
+
+  str_myers_free(&my);
+
+  return dist;
+}
+
+/**
+ * bounded edit distance of search to each of the len strings in arr, the
+ * match masks of search are only built once
+ * dist[i] is -1 where the distance exceeds max
+ * */
+void str_edit_distance_batch(const string_t search, const string_t *arr,
+                             size_t len, size_t max, size_t *dist) {
+
+  if (!arr || !dist)
+    return;
+
+  str_myers_t my;
+
+  if (!str_myers_init(&my, str_ptr(&search), search.len, 0)) {
+    for (size_t i = 0; i < len; i++)
+      dist[i] = -1;
+    return;
+  }
+
+  for (size_t i = 0; i < len; i++) {
+    size_t diff = arr[i].len > search.len ? arr[i].len - search.len
+                                          : search.len - arr[i].len;
+
+    dist[i] = diff > max ? (size_t)-1
+                         : str_myers_distance(&my, str_ptr(&arr[i]),
+                                              arr[i].len, max);
+  }
+
+  str_myers_free(&my);
+}
+
+/**
+ * position of the first substring of s within edit distance max of search
+ *
+ * the first end of such a match is found in one pass, a second pass with the
+ * reversed pattern from there picks the start with the smallest distance
+ * (the longer match on a tie), its length is stored in len
+ * returns -1 if there is none
+ * */
+size_t str_fuzzy_pos(string_t s, const string_t search, size_t max,
+                     size_t *len) {
+
+  const char *c = str_ptr(&s);
+  size_t m = search.len;
+
+  if (m <= max) {
+    if (len)
+      *len = 0;
+    return 0;
+  }
+
+  str_myers_t my;
+
+  if (!str_myers_init(&my, str_ptr(&search), m, 0))
+    return -1;
+
+  size_t end = -1, score = m;
+
+  for (size_t j = 0; j < s.len; j++) {
+    score += str_myers_column(&my, (unsigned char)c[j], 0);
+
+    if (score <= max) {
+      end = j + 1;
+      break;
+    }
+  }
+
+  str_myers_free(&my);
+
+  if (end == -1 || !str_myers_init(&my, str_ptr(&search), m, 1))
+    return -1;
+
+  // a match within max edits is at most m + max long
+  size_t window = end < m + max ? end : m + max;
+  size_t best = m, best_len = 0;
+  score = m;
+
+  for (size_t j = 1; j <= window; j++) {
+    score += str_myers_column(&my, (unsigned char)c[end - j], 1);
+
+    if (score <= best) {
+      best = score;
+      best_len = j;
+    }
+  }
+
+  str_myers_free(&my);
+
+  if (len)
+    *len = best_len;
+
+  return end - best_len;
+}
+
+/**
+ * builds the match masks of c (reversed if reverse is set)
+ * returns 0 if the allocation failed
+ * */
+static int str_myers_init(str_myers_t *my, const char *c, size_t m,
+                          int reverse) {
+
+  my->m = m;
+  my->words = m ? (m + 63) / 64 : 1;
+  my->last = 1ull << ((m ? m - 1 : 0) % 64);
+
+  if (my->words == 1) {
+    my->peq = my->peq_inline;
+    my->pv = &my->pv_inline;
+    my->mv = &my->mv_inline;
+  } else {
+    my->peq = malloc((256 + 2) * my->words * sizeof(uint64_t));
+
+    if (!my->peq)
+      return 0;
+
+    my->pv = my->peq + 256 * my->words;
+    my->mv = my->pv + my->words;
+  }
+
+  memset(my->peq, 0, 256 * my->words * sizeof(uint64_t));
+
+  for (size_t i = 0; i < m; i++) {
+    unsigned char b = (unsigned char)c[reverse ? m - 1 - i : i];
+    my->peq[b * my->words + i / 64] |= 1ull << (i % 64);
+  }
+
+  str_myers_reset(my);
+
+  return 1;
+}
+
+static void str_myers_free(str_myers_t *my) {
+
+  if (my->peq != my->peq_inline)
+    free(my->peq);
+}
+
+/**
+ * column 0, every row i has distance i
+ * */
+static void str_myers_reset(str_myers_t *my) {
+
+  for (size_t w = 0; w < my->words; w++) {
+    my->pv[w] = ~0ull;
+    my->mv[w] = 0;
+  }
+}
+
+/**
+ * advances by one text char, hin is the change of the top row (1 if the
+ * pattern has to be matched from the first text char, 0 for a search)
+ * returns the change of the last row
+ * */
+static inline int str_myers_column(str_myers_t *my, unsigned char c, int hin) {
+
+  const uint64_t *peq = my->peq + c * my->words;
+
+  for (size_t w = 0; w < my->words; w++) {
+    uint64_t pv = my->pv[w], mv = my->mv[w], eq = peq[w];
+    uint64_t high = w + 1 == my->words ? my->last : 1ull << 63;
+
+    uint64_t xv = eq | mv;
+
+    if (hin < 0)
+      eq |= 1;
+
+    uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+    uint64_t ph = mv | ~(xh | pv);
+    uint64_t mh = pv & xh;
+
+    int hout = ph & high ? 1 : mh & high ? -1 : 0;
+
+    ph <<= 1;
+    mh <<= 1;
+
+    if (hin < 0)
+      mh |= 1;
+    else if (hin > 0)
+      ph |= 1;
+
+    my->pv[w] = mh | ~(xv | ph);
+    my->mv[w] = ph & xv;
+
+    hin = hout;
+  }
+
+  return hin;
+}
+
+/**
+ * edit distance of the pattern to text, -1 once it has to exceed max
+ * */
+static size_t str_myers_distance(str_myers_t *my, const char *text, size_t n,
+                                 size_t max) {
+
+  // the last row is the top row for an empty pattern
+  if (!my->m)
+    return n > max ? (size_t)-1 : n;
+
+  str_myers_reset(my);
+
+  size_t score = my->m;
+
+  for (size_t j = 0; j < n; j++) {
+    score += str_myers_column(my, (unsigned char)text[j], 1);
+
+    // the distance drops by at most 1 per remaining char
+    if (max != -1 && score > max + (n - 1 - j))
+      return -1;
+  }
+
+  return score > max ? (size_t)-1 : score;
+}
+
+/**
+ * replaces search with replace in the string
+ * */
+string_t str_replace(string_t s, const string_t search,
+                     const string_t replace) {
+
+  if (!*str_ptr(&search))
+    return s;
+
+  return str_replace_loop(s, (const str_searcher_t *)0, search, replace);
+}
+
+/**
+ * replaces the needle of the prebuilt searcher with replace in the string
+ * */
+string_t str_replace_searcher(string_t s, const str_searcher_t *search,
+                              const string_t replace) {
+
+  if (!search || !search->needle.len)
+    return s;
+
+  return str_replace_loop(s, search, search->needle, replace);
+}
+
+/**
+ * the loop of str_replace and str_replace_searcher, search is found with the
+ * searcher or with str_pos if there is none
+ * */
+static string_t str_replace_loop(string_t s, const str_searcher_t *searcher,
+                                 const string_t search,
+                                 const string_t replace) {
+  string_t s_new = str_null;
+
+  // view of the not yet searched rest
+  string_t rest;
+  str_borrow(&rest, str_ptr(&s), s.len);
+
+  size_t pos;
+  while ((pos = searcher ? str_searcher_find(searcher, rest)
+                         : str_pos(rest, search)) != -1) {
+
+    if (pos != 0) {
+      // add everything up to the "search"
+      str_mem_append(&s_new, rest.str, pos);
+    }
+
+    // add the replace
+    str_mem_append(&s_new, str_ptr(&replace), replace.len);
+
+    rest.str += pos + search.len;
+    rest.len -= pos + search.len;
+  }
+
+  // add the rest
+  str_mem_append(&s_new, rest.str, rest.len);
+
+  return s_new;
+}
+
+/**
+ * builds an Aho-Corasick automaton over the reversed patterns, so all of them
+ * can be replaced in two linear passes (see str_replacer_apply)
+ *
+ * empty patterns are ignored, for duplicate patterns the first one is used
+ * */
+void str_replacer_init(str_replacer_t *r, const string_t *patterns,
+                       const string_t *replacements, size_t n) {
+
+  if (!r)
+    return;
+
+  memset(r, 0, sizeof(str_replacer_t));
+
+  r->replacements = malloc(sizeof(string_t) * (n ? n : 1));
+  r->pattern_len = malloc(sizeof(size_t) * (n ? n : 1));
+
+  if (!r->replacements || !r->pattern_len) {
+    str_replacer_free(r);
+    return;
+  }
+
+  // class 0 is every byte that doesn't occur in a pattern
+  r->nclasses = 1;
+  for (size_t i = 0; i < n; i++) {
+    const unsigned char *c = (const unsigned char *)str_ptr(&patterns[i]);
+
+    for (size_t j = 0; j < patterns[i].len; j++) {
+      if (!r->classes[c[j]])
+        r->classes[c[j]] = (unsigned int)r->nclasses++;
+    }
+  }
+
+  if (str_replacer_node(r) < 0)
+    return;
+
+  // trie of all patterns, read backwards
+  for (size_t i = 0; i < n; i++) {
+    const unsigned char *c = (const unsigned char *)str_ptr(&patterns[i]);
+
+    str_clone(r->replacements + i, replacements[i]);
+    r->pattern_len[i] = patterns[i].len;
+    r->n = i + 1;
+
+    if (!patterns[i].len)
+      continue;
+
+    int node = 0;
+    for (size_t j = patterns[i].len; j > 0; j--) {
+      int *next = &r->trans[(size_t)node * r->nclasses + r->classes[c[j - 1]]];
+
+      if (*next == -1) {
+        int child = str_replacer_node(r);
+
+        if (child < 0)
+          return;
+
+        // the transition table might have moved
+        next = &r->trans[(size_t)node * r->nclasses + r->classes[c[j - 1]]];
+        *next = child;
+      }
+
+      node = *next;
+    }
+
+    if (r->out[node] == -1)
+      r->out[node] = (int)i;
+  }
+
+  // breadth first: failure links folded into the transitions, so every
+  // node has a transition for every class
+  int *queue = malloc(sizeof(int) * r->nodes);
+  int *fail = malloc(sizeof(int) * r->nodes);
+
+  if (!queue || !fail) {
+    free(queue);
+    free(fail);
+    str_replacer_free(r);
+    return;
+  }
+
+  size_t head = 0, tail = 0;
+
+  fail[0] = 0;
+  for (size_t c = 0; c < r->nclasses; c++) {
+    int child = r->trans[c];
+
+    if (child > 0) {
+      fail[child] = 0;
+      queue[tail++] = child;
+    } else {
+      r->trans[c] = 0;
+    }
+  }
+
+  while (head < tail) {
+    int node = queue[head++];
+    int *row = &r->trans[(size_t)node * r->nclasses];
+    int *fail_row = &r->trans[(size_t)fail[node] * r->nclasses];
+
+    // longest pattern that is a suffix of this node
+    if (r->out[node] == -1)
+      r->out[node] = r->out[fail[node]];
+
+    for (size_t c = 0; c < r->nclasses; c++) {
+      if (row[c] > 0) {
+        fail[row[c]] = fail_row[c];
+        queue[tail++] = row[c];
+      } else {
+        row[c] = fail_row[c];
+      }
+    }
+  }
+
+  free(queue);
+  free(fail);
+}
+
+/**
+ * frees the automaton and the replacement copies
+ * */
+void str_replacer_free(str_replacer_t *r) {
+
+  if (!r)
+    return;
+
+  if (r->replacements) {
+    for (size_t i = 0; i < r->n; i++)
+      str_free(r->replacements + i);
+  }
+
+  free(r->replacements);
+  free(r->pattern_len);
+  free(r->trans);
+  free(r->out);
+
+  memset(r, 0, sizeof(str_replacer_t));
+}
+
+/**
+ * replaces all patterns of the replacer in s in O(n), independent of the
+ * number and length of the patterns
+ *
+ * matches don't overlap, at every position the leftmost and then the
+ * longest pattern wins
+ * returns str_null if the allocation failed
+ * */
+string_t str_replacer_apply(const str_replacer_t *r, const string_t s) {
+  string_t s_new = str_null;
+
+  const unsigned char *c = (const unsigned char *)str_ptr(&s);
+  size_t n = s.len;
+
+  if (!r || !r->trans) {
+    str_clone(&s_new, s);
+    return s_new;
+  }
+
+  if (!n)
+    return s_new;
+
+  // the automaton runs backwards over s, so the longest reversed pattern
+  // ending in a node is the longest pattern starting at the position
+  int *longest = malloc(n * sizeof(int));
+
+  if (!longest)
+    return str_null;
+
+  int node = 0;
+  for (size_t i = n; i > 0; i--) {
+    node = r->trans[(size_t)node * r->nclasses + r->classes[c[i - 1]]];
+    longest[i - 1] = r->out[node];
+  }
+
+  // most replacements are about as long as their patterns
+  str_reserve(&s_new, n);
+
+  size_t copied = 0;
+
+  for (size_t i = 0; i < n;) {
+    int p = longest[i];
+
+    if (p == -1) {
+      i++;
+      continue;
+    }
+
+    str_mem_append(&s_new, (char *)c + copied, i - copied);
+    str_mem_append(&s_new, str_ptr(&r->replacements[p]),
+                   r->replacements[p].len);
+
+    i += r->pattern_len[p];
+    copied = i;
+  }
+
+  // add the rest
+  str_mem_append(&s_new, (char *)c + copied, n - copied);
+
+  free(longest);
+
+  return s_new;
+}
+
+/**
+ * replaces every patterns[i] with replacements[i] in O(n)
+ * use str_replacer_init/str_replacer_apply to reuse the automaton
+ * */
+string_t str_replace_many(string_t s, const string_t *patterns,
+                          const string_t *replacements, size_t n) {
+  str_replacer_t r;
+
+  str_replacer_init(&r, patterns, replacements, n);
+
+  string_t s_new = str_replacer_apply(&r, s);
+
+  str_replacer_free(&r);
+
+  return s_new;
+}
+
+/**
+ * appends a node to the automaton, returns its index or -1 on failure
+ * */
+static int str_replacer_node(str_replacer_t *r) {
+
+  if (r->nodes == r->cap) {
+    size_t cap = r->cap ? r->cap * 2 : 64;
+
+    int *trans = realloc(r->trans, sizeof(int) * cap * r->nclasses);
+    if (!trans) {
+      str_replacer_free(r);
+      return -1;
+    }
+    r->trans = trans;
+
+    int *out = realloc(r->out, sizeof(int) * cap);
+    if (!out) {
+      str_replacer_free(r);
+      return -1;
+    }
+    r->out = out;
+
+    r->cap = cap;
+  }
+
+  size_t node = r->nodes++;
+
+  for (size_t c = 0; c < r->nclasses; c++)
+    r->trans[node * r->nclasses + c] = -1;
+
+  r->out[node] = -1;
+
+  return (int)node;
+}
+
+/**
+ * replaces search with replace in the string
+ * */
+string_t *strr_replace(string_t *s, const string_t search,
+                       const string_t replace) {
+
+  if (!s)
+    return s;
+
+  if (!*str_ptr(&search))
+    return s;
+
+  string_t s_new = str_replace(*s, search, replace);
+
+  str_free(s);
+  *s = s_new;
+
+  return s;
+}
+
+/**
+ * get the substring of a string using offset and length
+ * */
+string_t str_substr(string_t s, ssize_t offset, ssize_t len) {
+  string_t s_new = str_null;
+
+  str_clone(&s_new, s);
+
+  strr_substr(&s_new, offset, len);
+
+  return s_new;
+}
+
+/**
+ * get the substring of a string using offset and length
+ * */
+string_t *strr_substr(string_t *s, ssize_t offset, ssize_t len) {
+
+  if (!s)
+    return s;
+
+  if (!str_substr_range(s->len, &offset, &len)) {
+    str_free(s);
+    *s = str_null;
+    return s;
+  }
+
+  str_keep(s, (size_t)offset, (size_t)len);
+
+  return s;
+}
+
+/**
+ * resolves negative offsets/lengths of a substring of a s_len long string
+ * returns 0 if the substring is out of range
+ * */
+static int str_substr_range(size_t s_len, ssize_t *offset, ssize_t *len) {
+
+  if (*offset >= (ssize_t)s_len || (*offset < 0 && *len < *offset))
+    return 0;
+
+  if (*len > (ssize_t)s_len)
+    *len = (ssize_t)s_len;
+
+  if (*offset < 0) {
+    *offset = (ssize_t)s_len + *offset;
+    if (*offset < 0)
+      *offset = 0;
+  }
+  if (*len < 0)
+    *len = (ssize_t)s_len + *len - *offset;
+
+  if (*len < 0)
+    *len = 0;
+
+  if (*offset + *len > (ssize_t)s_len)
+    *len = (ssize_t)s_len - *offset;
+
+  return 1;
+}
+
+/**
+ * remove whitespaces at the end and the front
+ * */
+string_t str_trim(const string_t s) {
+  string_t s_new = str_null;
+
+  str_clone(&s_new, s);
+
+  strr_trim(&s_new);
+
+  return s_new;
+}
+
+/**
+ * remove whitespaces at the end and the front
+ * */
+string_t *strr_trim(string_t *s) {
+
+  if (!s)
+    return s;
+
+  size_t len = s->len;
+  char *base = str_ptr(s);
+  char *c = base;
+
+  while (len > 0 && str_chr_is_ws(c)) {
+    c++, len--;
+  }
+
+  while (len > 0 && str_chr_is_ws(c + len - 1)) {
+    len--;
+  }
+
+  str_keep(s, (size_t)(c - base), len);
+
+  return s;
+}
+
+/**
+ * remove whitespaces at the end
+ * */
+string_t str_rtrim(const string_t s) {
+  string_t s_new = str_null;
+
+  str_clone(&s_new, s);
+
+  strr_rtrim(&s_new);
+
+  return s_new;
+}
+
+/**
+ * remove whitespaces at the end
+ * */
+string_t *strr_rtrim(string_t *s) {
+
+  if (!s)
+    return s;
+
+  size_t len = s->len;
+  char *c = str_ptr(s);
+
+  if (!(*c))
+    return s;
+
+  while (len > 0 && str_chr_is_ws(c + len - 1)) {
+    len--;
+  }
+
+  str_keep(s, 0, len);
+
+  return s;
+}
+
+/**
+ * remove whitespaces at the front
+ * */
+string_t str_ltrim(const string_t s) {
+  string_t s_new = str_null;
+
+  str_clone(&s_new, s);
+
+  strr_ltrim(&s_new);
+
+  return s_new;
+}
+
+/**
+ * remove whitespaces at the front
+ * */
+string_t *strr_ltrim(string_t *s) {
+
+  if (!s)
+    return s;
+
+  char *c = str_ptr(s);
+
+  size_t start = 0;
+  size_t len = s->len;
+  while (len > 0 && str_chr_is_ws(c + start)) {
+    start++, len--;
+  }
+
+  str_keep(s, start, len);
+
+  return s;
+}
+
+/**
+ * reverse the string
+ * */
+string_t str_rev(const string_t s) {
+  string_t s_new = str_null;
+
+  char *c = str_ptr(&s);
+
+  if (!*c)
+    return s_new;
+
+  str_clone(&s_new, s);
+
+  strr_rev(&s_new);
+
+  return s_new;
+}
+
+/**
+ * reverse the string
+ * */
+string_t *strr_rev(string_t *s) {
+
+  if (!s || !s->len)
+    return s;
+
+  char *c = str_writable(s, s->len);
+
+  if (!c)
+    return s;
+
+  // swap from both ends towards the middle
+  for (size_t i = 0, j = s->len - 1; i < j; i++, j--) {
+    char tmp = c[i];
+    c[i] = c[j];
+    c[j] = tmp;
+  }
+
+  return s;
+}
+
+//  TODO: pad with UTF8-chars
+/**
+ * pad the string to len by prepending c
+ * */
+string_t str_lpad(string_t s, char c, size_t len) {
+  string_t s_new;
+
+  str_clone(&s_new, s);
+
+  strr_lpad(&s_new, c, len);
+
+  return s_new;
+}
+
+/**
+ * pad the string to len by prepending c
+ * */
+string_t *strr_lpad(string_t *s, char c, size_t len) {
+
+  if (!s)
+    return s;
+
+  if (s->len < len) {
+    size_t padding = len - s->len;
+    char *buf = str_writable(s, len);
+
+    if (!buf)
+      return s;
+
+    memmove(buf + padding, buf, s->len);
+    memset(buf, c, padding);
+
+    s->len = len;
+    *(buf + len) = 0;
+  }
+
+  return s;
+}
+
+// TODO: pad with UTF8-chars
+/**
+ * pad the string to len by appending c
+ * */
+string_t str_rpad(string_t s, char c, size_t len) {
+  string_t s_new;
+
+  str_clone(&s_new, s);
+
+  strr_rpad(&s_new, c, len);
+
+  return s_new;
+}
+
+/**
+ * pad the string to len by appending c
+ * */
+string_t *strr_rpad(string_t *s, char c, size_t len) {
+
+  if (!s)
+    return s;
+
+  if (s->len < len) {
+    size_t padding = len - s->len;
+    char *buf = str_writable(s, len);
+
+    if (!buf)
+      return s;
+
+    memset(buf + s->len, c, padding);
+
+    s->len = len;
+    *(buf + len) = 0;
+  }
+
+  return s;
+}
+
+/**
+ * initialize the tokenizer, empty tokens are skipped
+ * */
+tokenizer_t str_token_init(string_t s, const string_t delimiter) {
+  return str_token_init_flags(s, delimiter, STR_TOKEN_COLLAPSE);
+}
+
+/**
+ * initialize the tokenizer
+ *
+ * STR_TOKEN_COLLAPSE skips empty tokens, without it n delimiters always give
+ * n + 1 tokens like str_explode
+ * STR_TOKEN_ANY splits on every byte of delimiter, e.g. str(" \t")
+ * */
+tokenizer_t str_token_init_flags(string_t s, const string_t delimiter,
+                                 char flags) {
+  tokenizer_t tok = {.delimiter = delimiter,
+                     .base = s,
+                     .pos = 0,
+                     .searcher = (void *)0,
+                     .flags = flags,
+                     .set = {0}};
+
+  if (flags & STR_TOKEN_ANY) {
+    const unsigned char *c = (const unsigned char *)str_ptr(&tok.delimiter);
+
+    for (size_t i = 0; i < tok.delimiter.len; i++)
+      tok.set[c[i] >> 6] |= 1ull << (c[i] & 63);
+  }
+
+  return tok;
+}
+
+/**
+ * initialize the tokenizer with a prebuilt delimiter searcher
+ * the searcher has to outlive the tokenizer
+ * */
+tokenizer_t str_token_init_searcher(string_t s,
+                                    const str_searcher_t *searcher) {
+  tokenizer_t tok = str_token_init(s, searcher->needle);
+
+  tok.searcher = searcher;
+
+  return tok;
+}
+
+/**
+ * get the next token from the tokenizer
+ * */
+char str_token_next(tokenizer_t *tok, string_t *s) {
+
+  if (!tok)
+    return 0;
+
+  if (!s)
+    return 0;
+
+  str_free(s);
+
+  string_t view;
+
+  if (!str_token_next_view(tok, &view))
+    return 0;
+
+  str_clone(s, view);
+
+  return 1;
+}
+
+/**
+ * get the next token from the tokenizer as a borrowed slice
+ * the slice points into the tokenized string (or into the tokenizer for
+ * inline strings), nothing is allocated
+ * */
+char str_token_next_view(tokenizer_t *tok, string_t *s) {
+
+  if (!tok)
+    return 0;
+
+  if (!s)
+    return 0;
+
+  char *base = str_ptr(&tok->base);
+  size_t len = tok->base.len;
+  size_t delimiter_len;
+
+  if (!(tok->flags & STR_TOKEN_COLLAPSE)) {
+    // pos is moved past the end after the last token
+    if (tok->pos > len)
+      return 0;
+
+    size_t pos =
+        str_token_find(tok, base + tok->pos, len - tok->pos, &delimiter_len);
+
+    str_borrow(s, base + tok->pos, pos);
+    tok->pos += pos + (delimiter_len ? delimiter_len : 1);
+
+    return 1;
+  }
+
+  while (tok->pos < len) {
+    if (tok->flags & STR_TOKEN_ANY) {
+      // skip whole runs of delimiters at once
+      while (tok->pos < len &&
+             tok->set[(unsigned char)base[tok->pos] >> 6] >>
+                     ((unsigned char)base[tok->pos] & 63) &
+                 1)
+        tok->pos++;
+
+      if (tok->pos == len)
+        return 0;
+    }
+
+    size_t pos =
+        str_token_find(tok, base + tok->pos, len - tok->pos, &delimiter_len);
+
+    if (pos > 0) {
+      str_borrow(s, base + tok->pos, pos);
+      tok->pos += pos + delimiter_len;
+      return 1;
+    }
+
+    // skip empty tokens
+    tok->pos += delimiter_len;
+  }
+
+  return 0;
+}
+
+/**
+ * returns the position of the next delimiter in c or n if there is none,
+ * delimiter_len is set to the length of the delimiter found (0 for none)
+ * */
+static size_t str_token_find(const tokenizer_t *tok, const char *c, size_t n,
+                             size_t *delimiter_len) {
+
+  size_t m = tok->delimiter.len;
+  size_t pos;
+
+  *delimiter_len = 0;
+
+  // nothing to split on or nothing left
+  if (!m || !n)
+    return n;
+
+  if (tok->flags & STR_TOKEN_ANY) {
+    pos = str_token_find_any(tok, c, n);
+    m = 1;
+  } else if (m == 1) {
+    const char *d = memchr(c, *str_ptr(&tok->delimiter), n);
+    pos = d ? (size_t)(d - c) : n;
+  } else if (tok->searcher) {
+    string_t rest;
+    str_borrow(&rest, c, n);
+    pos = str_searcher_find(tok->searcher, rest);
+  } else {
+    pos = str_find(c, n, str_ptr(&tok->delimiter), m, 0);
+  }
+
+  if (pos == -1)
+    pos = n;
+
+  *delimiter_len = pos < n ? m : 0;
+
+  return pos;
+}
+
+/**
+ * returns the position of the first byte of c that is in the delimiter set
+ * or n, sets of up to 4 bytes are compared 16 bytes at a time
+ * */
+static size_t str_token_find_any(const tokenizer_t *tok, const char *c,
+                                 size_t n) {
+  size_t i = 0;
+
+#ifdef STR_SIMD_X86
+  size_t m = tok->delimiter.len;
+
+  if (m <= 4) {
+    const char *d = str_ptr(&tok->delimiter);
+
+    const __m128i d0 = _mm_set1_epi8(d[0]);
+    const __m128i d1 = _mm_set1_epi8(d[m > 1 ? 1 : 0]);
+    const __m128i d2 = _mm_set1_epi8(d[m > 2 ? 2 : 0]);
+    const __m128i d3 = _mm_set1_epi8(d[m > 3 ? 3 : 0]);
+
+    for (; i + 16 <= n; i += 16) {
+      __m128i block = _mm_loadu_si128((const __m128i *)(c + i));
+
+      __m128i eq = _mm_or_si128(
+          _mm_or_si128(_mm_cmpeq_epi8(block, d0), _mm_cmpeq_epi8(block, d1)),
+          _mm_or_si128(_mm_cmpeq_epi8(block, d2), _mm_cmpeq_epi8(block, d3)));
+
+      unsigned int mask = (unsigned int)_mm_movemask_epi8(eq);
+
+      if (mask)
+        return i + (size_t)__builtin_ctz(mask);
+    }
+  }
+#endif
+
+  for (; i < n; i++) {
+    unsigned char b = (unsigned char)c[i];
+
+    if (tok->set[b >> 6] >> (b & 63) & 1)
+      return i;
+  }
+
+  return n;
+}
+
+/**
+ * clones the given string into the pointer
+ * clones the char* aswell
+ * */
+void str_clone(string_t *target, string_t s) {
+
+  if (!target)
+    return;
+
+  // shared chars are immutable, another reference is as good as a copy
+  if (s.flags & STR_SHARED) {
+    str_shared_retain(s.shared);
+    *target = s;
+    return;
+  }
+
+  str_clone_from_chr(target, str_ptr(&s), s.len);
+}
+
+/**
+ * clones the given char* and creates a new string with it
+ * */
+void str_clone_from_chr(string_t *target, char *c, size_t len) {
+
+  if (!target)
+    return;
+
+  // short strings are stored inline, no allocation needed
+  if (len <= STR_SSO_CAP) {
+    memmove(target->sso, c, len);
+
+    target->len = len;
+    target->flags = STR_SSO;
+
+    *(target->sso + len) = 0;
+    return;
+  }
+
+  char *new_str = malloc(len + 1);
+
+  if (!new_str)
+    return;
+
+  memcpy(new_str, c, len);
+
+  target->str = new_str;
+  target->len = len;
+  target->cap = len;
+  target->flags = STR_OWNER | STR_HEAP;
+
+  *(target->str + len) = 0;
+}
+
+/**
+ * creates prefix + formatted string + suffix with a single allocation
+ * (see str_format)
+ * */
+static string_t str_from_format(const string_t prefix, char *str,
+                                va_list args, const string_t suffix) {
+  string_t s;
+
+  // first pass: exact length
+  va_list args_len;
+  va_copy(args_len, args);
+
+  size_t len = str_format((char *)0, str, args_len);
+
+  va_end(args_len);
+
+  char *c = str_init_len(&s, prefix.len + len + suffix.len);
+
+  if (!c)
+    return str_null;
+
+  // second pass: write
+  memcpy(c, str_ptr(&prefix), prefix.len);
+  str_format(c + prefix.len, str, args);
+  memcpy(c + prefix.len + len, str_ptr(&suffix), suffix.len);
+
+  return s;
+}
+
+/**
+ * writes the formatted string to buf and returns its length, buf can be
+ * (char *)0 to only get the length
+ *
+ * supported formats:
+ *
+ * %d: int
+ * %l: long
+ * %u: unsigned int
+ * %x, %X: unsigned int (hex)
+ * %f: double
+ * %c: char
+ * %s: char* string
+ * %S: string_t string
+ * %%: %
+ *
+ * d, u, x and X take the length modifiers l (long) and z (size_t)
+ * flags: - (left aligned), 0 (pad numbers with 0), width and .precision
+ * (digits of %f, max chars of %s/%S) can be given as number or *
+ *
+ * */
+static size_t str_format(char *buf, char *str, va_list args) {
+
+  size_t len = 0;
+
+  while (*str) {
+    if (*str != '%') {
+      char *str_start = str;
+      while (*str && *str != '%')
+        str++;
+
+      str_format_put(buf, &len, str_start, (size_t)(str - str_start));
+      continue;
+    }
+
+    str++;
+
+    str_format_spec_t spec = {.width = 0, .precision = -1, .left = 0,
+                              .zero = 0};
+
+    for (;; str++) {
+      if (*str == '-')
+        spec.left = 1;
+      else if (*str == '0')
+        spec.zero = 1;
+      else
+        break;
+    }
+
+    if (*str == '*') {
+      int width = va_arg(args, int);
+      if (width < 0) {
+        spec.left = 1;
+        width = -width;
+      }
+      spec.width = (size_t)width;
+      str++;
+    } else {
+      while (*str >= '0' && *str <= '9')
+        spec.width = spec.width * 10 + (size_t)(*str++ - '0');
+    }
+
+    if (*str == '.') {
+      str++;
+      spec.precision = 0;
+
+      if (*str == '*') {
+        spec.precision = va_arg(args, int);
+        str++;
+      } else {
+        while (*str >= '0' && *str <= '9')
+          spec.precision = spec.precision * 10 + (*str++ - '0');
+      }
+    }
+
+    // %l alone is a long, followed by d, u, x or X it's a length modifier
+    char length = 0;
+    if (*str == 'z' ||
+        (*str == 'l' && (str[1] == 'd' || str[1] == 'u' || str[1] == 'x' ||
+                         str[1] == 'X'))) {
+      length = *str++;
+    }
+
+    switch (*str) {
+    case 'd': {
+      long long arg;
+      if (length == 'z')
+        arg = va_arg(args, ssize_t);
+      else if (length == 'l')
+        arg = va_arg(args, long);
+      else
+        arg = va_arg(args, int);
+
+      // negate as unsigned so the minimum value doesn't overflow
+      unsigned long long mag =
+          arg < 0 ? 0ULL - (unsigned long long)arg : (unsigned long long)arg;
+      str_format_int(buf, &len, spec, mag, arg < 0, 10, 0);
+      break;
+    }
+    case 'l': {
+      long arg = va_arg(args, long);
+
+      unsigned long long mag =
+          arg < 0 ? 0ULL - (unsigned long long)arg : (unsigned long long)arg;
+      str_format_int(buf, &len, spec, mag, arg < 0, 10, 0);
+      break;
+    }
+    case 'u':
+    case 'x':
+    case 'X': {
+      unsigned long long arg;
+      if (length == 'z')
+        arg = va_arg(args, size_t);
+      else if (length == 'l')
+        arg = va_arg(args, unsigned long);
+      else
+        arg = va_arg(args, unsigned int);
+
+      str_format_int(buf, &len, spec, arg, 0, *str == 'u' ? 10 : 16,
+                     *str == 'X');
+      break;
+    }
+    case 'f': {
+      double arg = va_arg(args, double);
+      int precision = spec.precision < 0 ? 6 : spec.precision;
+
+      // libc is used for correctly rounded digits
+      char tmp[64];
+      int n = snprintf(tmp, sizeof(tmp), "%.*f", precision, arg);
+
+      if (n < 0)
+        break;
+
+      if ((size_t)n < sizeof(tmp)) {
+        str_format_pad(buf, &len, spec, tmp, (size_t)n, 1);
+      } else {
+        // huge values, format straight into the target
+        if (spec.width > (size_t)n && !spec.left)
+          str_format_fill(buf, &len, ' ', spec.width - (size_t)n);
+        if (buf)
+          snprintf(buf + len, (size_t)n + 1, "%.*f", precision, arg);
+        len += (size_t)n;
+        if (spec.width > (size_t)n && spec.left)
+          str_format_fill(buf, &len, ' ', spec.width - (size_t)n);
+      }
+      break;
+    }
+    case 'c': {
+      char arg = (char)va_arg(args, int);
+
+      str_format_pad(buf, &len, spec, &arg, 1, 0);
+      break;
+    }
+    case 'S': {
+      string_t arg = va_arg(args, string_t);
+      size_t arg_len = arg.len;
+
+      if (spec.precision >= 0 && (size_t)spec.precision < arg_len)
+        arg_len = (size_t)spec.precision;
+
+      str_format_pad(buf, &len, spec, str_ptr(&arg), arg_len, 0);
+      break;
+    }
+    case 's': {
+      char *arg = va_arg(args, char *);
+      size_t arg_len = 0;
+
+      if (!arg)
+        arg = (char *)str_empty_chr;
+
+      // don't read past the precision, the string might not be terminated
+      while (arg[arg_len] &&
+             (spec.precision < 0 || arg_len < (size_t)spec.precision))
+        arg_len++;
+
+      str_format_pad(buf, &len, spec, arg, arg_len, 0);
+      break;
+    }
+    case '%':
+      str_format_put(buf, &len, "%", 1);
+      break;
+    case '\0':
+      // a trailing % is dropped
+      continue;
+    default:
+      break;
+    }
+    str++;
+  }
+
+  return len;
+}
+
+/**
+ * writes n bytes of data at buf + *len (if buf is given) and advances *len
+ * */
+static void str_format_put(char *buf, size_t *len, const char *data,
+                           size_t n) {
+
+  if (buf)
+    memcpy(buf + *len, data, n);
+
+  *len += n;
+}
+
+/**
+ * writes n times c at buf + *len (if buf is given) and advances *len
+ * */
+static void str_format_fill(char *buf, size_t *len, char c, size_t n) {
+
+  if (buf)
+    memset(buf + *len, c, n);
+
+  *len += n;
+}
+
+/**
+ * writes data padded to the width of spec, numeric values are padded with 0
+ * behind their sign if the 0 flag is set
+ * */
+static void str_format_pad(char *buf, size_t *len, str_format_spec_t spec,
+                           const char *data, size_t n, int numeric) {
+
+  size_t padding = spec.width > n ? spec.width - n : 0;
+
+  if (spec.left) {
+    str_format_put(buf, len, data, n);
+    str_format_fill(buf, len, ' ', padding);
+    return;
+  }
+
+  if (spec.zero && numeric) {
+    if (n && (*data == '-' || *data == '+')) {
+      str_format_put(buf, len, data, 1);
+      data++, n--;
+    }
+    str_format_fill(buf, len, '0', padding);
+  } else {
+    str_format_fill(buf, len, ' ', padding);
+  }
+
+  str_format_put(buf, len, data, n);
+}
+
+/**
+ * writes an integer given as magnitude and sign in base 10 or 16
+ * */
+static void str_format_int(char *buf, size_t *len, str_format_spec_t spec,
+                           unsigned long long value, int negative, int base,
+                           int upper) {
+
+  const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+
+  // 64 bit values have at most 20 digits + sign
+  char tmp[24];
+  char *end = tmp + sizeof(tmp);
+  char *c = end;
+
+  if (base == 10) {
+    c = tmp + 1;
+    end = c + str_fmt_u64(c, value);
+  } else {
+    do {
+      *--c = digits[value % (unsigned)base];
+      value /= (unsigned)base;
+    } while (value);
+  }
+
+  if (negative)
+    *--c = '-';
+
+  str_format_pad(buf, len, spec, c, (size_t)(end - c), 1);
+}
+
+/**
+ * checks if the 8 bytes of w are all in '0'..'9'
+ * */
+static inline int str_swar_digits(uint64_t w) {
+  // '0'..'9' is 0x30..0x39, adding 6 must not carry out of the low nibble
+  return (w & 0xf0f0f0f0f0f0f0f0ull) == 0x3030303030303030ull &&
+         ((w + 0x0606060606060606ull) & 0xf0f0f0f0f0f0f0f0ull) ==
+             0x3030303030303030ull;
+}
+
+/**
+ * converts 8 digits, the first digit is in the lowest byte
+ * */
+static inline uint64_t str_swar_parse8(uint64_t w) {
+  w -= 0x3030303030303030ull;
+
+  // pairs of digits, then groups of 4, then all 8
+  w = (w * 10 + (w >> 8)) & 0x00ff00ff00ff00ffull;
+  w = (w * 100 + (w >> 16)) & 0x0000ffff0000ffffull;
+  w = (w * 10000 + (w >> 32)) & 0xffffffffull;
+
+  return w;
+}
+
+/**
+ * parses the leading digits of c, 8 at a time where possible
+ * returns the number of digits, value saturates at UINT64_MAX on overflow
+ * */
+static size_t str_parse_digits(const char *c, size_t len, uint64_t *value,
+                               int *overflow) {
+
+  size_t i = 0;
+
+  while (i < len && c[i] == '0')
+    i++;
+
+  // up to 19 significant digits cannot overflow
+  size_t start = i;
+  uint64_t v = 0;
+
+#ifdef STR_SWAR_LE
+  while (len - i >= 8 && i - start <= 11) {
+    uint64_t w;
+    memcpy(&w, c + i, 8);
+
+    if (!str_swar_digits(w))
+      break;
+
+    v = v * 100000000 + str_swar_parse8(w);
+    i += 8;
+  }
+#endif
+
+  while (i < len && i - start < 19 && (unsigned char)(c[i] - '0') < 10)
+    v = v * 10 + (uint64_t)(c[i++] - '0');
+
+  *overflow = 0;
+
+  if (i < len && (unsigned char)(c[i] - '0') < 10) {
+    uint64_t d = (uint64_t)(c[i++] - '0');
+
+    if (v > (UINT64_MAX - d) / 10)
+      *overflow = 1;
+    else
+      v = v * 10 + d;
+
+    while (i < len && (unsigned char)(c[i] - '0') < 10) {
+      *overflow = 1;
+      i++;
+    }
+  }
+
+  *value = *overflow ? UINT64_MAX : v;
+
+  return i;
+}
+
+/**
+ * parses an unsigned decimal number
+ *
+ * without end the whole string has to be the number, otherwise parsing stops
+ * at the first char that is not a digit and its offset is stored in end
+ * returns STR_PARSE_OK, STR_PARSE_INVALID if there are no digits (or other
+ * chars without end) or STR_PARSE_OVERFLOW, then value is UINT64_MAX
+ * */
+int str_parse_u64(const string_t s, uint64_t *value, size_t *end) {
+
+  const char *c = str_ptr(&s);
+  int overflow = 0;
+  uint64_t v = 0;
+  size_t i = c ? str_parse_digits(c, s.len, &v, &overflow) : 0;
+
+  if (end)
+    *end = i;
+
+  if (!i || (!end && i != s.len))
+    return STR_PARSE_INVALID;
+
+  if (value)
+    *value = v;
+
+  return overflow ? STR_PARSE_OVERFLOW : STR_PARSE_OK;
+}
+
+/**
+ * parses a signed decimal number with an optional + or -
+ *
+ * see str_parse_u64, on overflow value is INT64_MIN or INT64_MAX
+ * */
+int str_parse_i64(const string_t s, int64_t *value, size_t *end) {
+
+  const char *c = str_ptr(&s);
+  size_t sign = c && s.len && (*c == '-' || *c == '+');
+  int negative = sign && *c == '-';
+
+  int overflow = 0;
+  uint64_t v = 0;
+  size_t i = c ? str_parse_digits(c + sign, s.len - sign, &v, &overflow) : 0;
+
+  if (end)
+    *end = i ? i + sign : 0;
+
+  if (!i || (!end && i + sign != s.len))
+    return STR_PARSE_INVALID;
+
+  uint64_t limit = (uint64_t)INT64_MAX + (uint64_t)negative;
+
+  if (v > limit)
+    overflow = 1;
+
+  if (value) {
+    if (overflow)
+      *value = negative ? INT64_MIN : INT64_MAX;
+    else
+      *value = negative ? (int64_t)(0 - v) : (int64_t)v;
+  }
+
+  return overflow ? STR_PARSE_OVERFLOW : STR_PARSE_OK;
+}
+
+static const char str_digits2[201] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+
+/**
+ * number of decimal digits of value
+ * */
+static size_t str_fmt_digits(uint64_t value) {
+
+  size_t n = 1;
+
+  for (;;) {
+    if (value < 10)
+      return n;
+    if (value < 100)
+      return n + 1;
+    if (value < 1000)
+      return n + 2;
+    if (value < 10000)
+      return n + 3;
+
+    value /= 10000;
+    n += 4;
+  }
+}
+
+/**
+ * writes value in decimal to buf (at least STR_FMT_U64_MAX chars, no null
+ * byte is written), two digits at a time
+ * returns the number of chars
+ * */
+size_t str_fmt_u64(char *buf, uint64_t value) {
+
+  size_t n = str_fmt_digits(value);
+  char *c = buf + n;
+
+  while (value >= 100) {
+    unsigned int i = (unsigned int)(value % 100) * 2;
+    value /= 100;
+
+    *--c = str_digits2[i + 1];
+    *--c = str_digits2[i];
+  }
+
+  if (value >= 10) {
+    *--c = str_digits2[value * 2 + 1];
+    *--c = str_digits2[value * 2];
+  } else {
+    *--c = (char)('0' + value);
+  }
+
+  return n;
+}
+
+/**
+ * creates a string for len chars (inline if short enough) and returns its
+ * buffer, the null byte is already set
+ * */
+static char *str_init_len(string_t *s, size_t len) {
+
+  *s = str_null;
+
+  if (len <= STR_SSO_CAP) {
+    s->flags = STR_SSO;
+    s->len = len;
+    *(s->sso + len) = 0;
+
+    return s->sso;
+  }
+
+  char *c = malloc(len + 1);
+
+  if (!c)
+    return (char *)0;
+
+  s->str = c;
+  s->len = len;
+  s->cap = len;
+  s->flags = STR_HEAP | STR_OWNER;
+  *(c + len) = 0;
+
+  return c;
+}
+
+/**
+ * string: pointer to the string
+ * offset: offset to insert-position
+ * data: pointer to the insert data
+ * data_len: length of the insert data
+ * */
+void str_mem_insert(string_t *string, size_t offset, void *data,
+                    size_t data_len) {
+
+  if (!string)
+    return;
+
+  if (!data)
+    return;
+
+  if (offset > string->len)
+    offset = string->len;
+
+  char *c = str_writable(string, string->len + data_len);
+
+  if (!c)
+    return;
+
+  memmove(c + offset + data_len, c + offset, string->len - offset);
+
+  memcpy(c + offset, data, data_len);
+
+  string->len += data_len;
+
+  *(c + string->len) = 0;
+}
+
+/**
+ * string: pointer to the string
+ * offset: offset to the replaced-start
+ * len: length of the replaced string
+ * data: pointer to the replacement data
+ * data_len: length of the replacement data
+ * */
+void str_mem_replace(string_t *string, size_t offset, size_t len, void *data,
+                     size_t data_len) {
+
+  if (!string)
+    return;
+
+  if (!data)
+    return;
+
+  if (offset >= string->len)
+    offset = string->len ? string->len - 1 : 0;
+
+  if (offset + len > string->len)
+    len = string->len - offset;
+
+  size_t new_len = string->len - len + data_len;
+
+  // the tail is moved before shrinking, so make room for the larger size
+  char *c =
+      str_writable(string, new_len > string->len ? new_len : string->len);
+
+  if (!c)
+    return;
+
+  memmove(c + offset + data_len, c + offset + len,
+          string->len - offset - len);
+
+  memcpy(c + offset, data, data_len);
+
+  string->len = new_len;
+
+  *(c + string->len) = 0;
+}
+
+/**
+ * string: pointer to the string
+ * len: new string length
+ * data: data to be appended
+ * data_len: size of the data to be appended
+ * */
+void str_mem_append(string_t *string, void *data, size_t data_len) {
+
+  if (!string)
+    return;
+
+  if (!data)
+    return;
+
+  char *c = str_writable(string, string->len + data_len);
+
+  if (!c)
+    return;
+
+  memcpy(c + string->len, data, data_len);
+  string->len += data_len;
+
+  // add null terminator
+  *(c + string->len) = 0;
+}
+
+/**
+ * creates an arena for short lived strings, block_size 0 uses
+ * STR_ARENA_BLOCK_SIZE
+ * strings allocated in the arena are released all at once by
+ * str_arena_reset or str_arena_destroy, str_free ignores them
+ * */
+str_arena_t *str_arena_create(size_t block_size) {
+
+  str_arena_t *arena = malloc(sizeof(str_arena_t));
+
+  if (!arena)
+    return (void *)0;
+
+  arena->block_size = block_size ? block_size : STR_ARENA_BLOCK_SIZE;
+  arena->head = (void *)0;
+
+  return arena;
+}
+
+/**
+ * releases all strings of the arena, the current block is kept for reuse
+ * */
+void str_arena_reset(str_arena_t *arena) {
+
+  if (!arena || !arena->head)
+    return;
+
+  str_arena_block_t *block = arena->head->next;
+  while (block) {
+    str_arena_block_t *next = block->next;
+    free(block);
+    block = next;
+  }
+
+  arena->head->next = (void *)0;
+  arena->head->used = 0;
+}
+
+/**
+ * frees the arena and all strings allocated in it
+ * */
+void str_arena_destroy(str_arena_t *arena) {
+
+  if (!arena)
+    return;
+
+  str_arena_reset(arena);
+
+  free(arena->head);
+  free(arena);
+}
+
+/**
+ * bump allocates size bytes in the arena
+ * */
+static char *str_arena_alloc(str_arena_t *arena, size_t size) {
+
+  str_arena_block_t *block = arena->head;
+
+  if (!block || block->size - block->used < size) {
+    size_t block_size = size > arena->block_size ? size : arena->block_size;
+
+    block = malloc(sizeof(str_arena_block_t) + block_size);
+
+    if (!block)
+      return (char *)0;
+
+    block->size = block_size;
+    block->used = 0;
+    block->next = arena->head;
+
+    arena->head = block;
+  }
+
+  char *c = block->data + block->used;
+  block->used += size;
+
+  return c;
+}
+
+/**
+ * creates an arena string with room for len chars, short strings are stored
+ * inline instead
+ * returns the writable buffer of s
+ * */
+static char *str_arena_init(str_arena_t *arena, string_t *s, size_t len) {
+
+  *s = str_null;
+
+  if (len <= STR_SSO_CAP) {
+    s->flags = STR_SSO;
+    s->len = len;
+    *(s->sso + len) = 0;
+
+    return s->sso;
+  }
+
+  char *c = arena ? str_arena_alloc(arena, len + 1) : (char *)0;
+
+  if (!c)
+    return (char *)0;
+
+  s->str = c;
+  s->len = len;
+  s->flags = STR_ARENA;
+  *(c + len) = 0;
+
+  return c;
+}
+
+/**
+ * clones the string into the arena
+ * */
+string_t str_arena_clone(str_arena_t *arena, const string_t s) {
+  string_t s_new;
+
+  char *c = str_arena_init(arena, &s_new, s.len);
+
+  if (!c)
+    return str_null;
+
+  memcpy(c, str_ptr(&s), s.len);
+
+  return s_new;
+}
+
+/**
+ * append to the given string in the arena (see str_format)
+ * */
+string_t str_arena_cat(str_arena_t *arena, const string_t s, char *str, ...) {
+  string_t s_new;
+
+  va_list args;
+  va_start(args, str);
+
+  va_list args_len;
+  va_copy(args_len, args);
+
+  size_t len = str_format((char *)0, str, args_len);
+
+  va_end(args_len);
+
+  char *c = str_arena_init(arena, &s_new, s.len + len);
+
+  if (c) {
+    memcpy(c, str_ptr(&s), s.len);
+    str_format(c + s.len, str, args);
+  } else {
+    s_new = str_null;
+  }
+
+  va_end(args);
+
+  return s_new;
+}
+
+/**
+ * replaces search with replace in the string, the result is allocated
+ * once in the arena
+ * */
+string_t str_arena_replace(str_arena_t *arena, string_t s,
+                           const string_t search, const string_t replace) {
+  string_t s_new;
+
+  if (!search.len)
+    return str_arena_clone(arena, s);
+
+  const char *base = str_ptr(&s);
+
+  // count the matches to get the exact length
+  size_t count = 0;
+  size_t pos;
+  string_t rest;
+  str_borrow(&rest, base, s.len);
+
+  while ((pos = str_pos(rest, search)) != -1) {
+    count++;
+    rest.str += pos + search.len;
+    rest.len -= pos + search.len;
+  }
+
+  char *c = str_arena_init(arena, &s_new,
+                           s.len - count * search.len + count * replace.len);
+
+  if (!c)
+    return str_null;
+
+  str_borrow(&rest, base, s.len);
+
+  while ((pos = str_pos(rest, search)) != -1) {
+    memcpy(c, rest.str, pos);
+    memcpy(c + pos, str_ptr(&replace), replace.len);
+    c += pos + replace.len;
+
+    rest.str += pos + search.len;
+    rest.len -= pos + search.len;
+  }
+
+  // add the rest
+  memcpy(c, rest.str, rest.len);
+
+  return s_new;
+}
+
+/**
+ * get the substring of a string using offset and length, the substring is
+ * copied into the arena
+ * */
+string_t str_arena_substr(str_arena_t *arena, string_t s, ssize_t offset,
+                          ssize_t len) {
+  string_t part;
+
+  if (!str_substr_range(s.len, &offset, &len))
+    return str_null;
+
+  str_borrow(&part, str_ptr(&s) + offset, (size_t)len);
+
+  return str_arena_clone(arena, part);
+}
+
+/**
+ * initializes an empty intern table, nothing is allocated until the first
+ * str_intern
+ * */
+void str_intern_init(str_intern_t *intern) {
+
+  if (!intern)
+    return;
+
+  intern->table = (str_intern_table_t *)0;
+  intern->arena = (str_arena_t *)0;
+  intern->count = 0;
+  intern->lock = 0;
+}
+
+/**
+ * frees the table and all interned strings, no other thread may use it
+ * anymore
+ * */
+void str_intern_free(str_intern_t *intern) {
+
+  if (!intern)
+    return;
+
+  str_intern_table_t *table = intern->table;
+  while (table) {
+    str_intern_table_t *prev = table->prev;
+    free(table);
+    table = prev;
+  }
+
+  str_arena_destroy(intern->arena);
+
+  str_intern_init(intern);
+}
+
+/**
+ * returns the canonical copy of s, s is copied in on first use
+ * interned strings of the same table are equal if their pointers are
+ * (str_intern_equals), str_free is a no-op for them
+ *
+ * lookups of strings that are already interned don't lock or allocate and
+ * may run concurrently with each other and with one adding a string
+ * returns str_null if the allocation failed
+ * */
+string_t str_intern(str_intern_t *intern, const string_t s) {
+
+  if (!intern)
+    return str_null;
+
+  const char *c = str_ptr(&s);
+  uint64_t hash = str_hash(s, 0);
+
+  const char *slot = str_intern_probe(
+      __atomic_load_n(&intern->table, __ATOMIC_ACQUIRE), c, s.len, hash);
+
+  if (slot)
+    return str_intern_string(slot);
+
+  str_intern_lock(intern);
+
+  // another writer might have added it in the meantime
+  str_intern_table_t *table = intern->table;
+  slot = str_intern_probe(table, c, s.len, hash);
+
+  if (!slot) {
+    if (!table || (intern->count + 1) * 2 > table->mask + 1)
+      table = str_intern_grow(intern);
+
+    if (table)
+      slot = str_intern_add(intern, table, c, s.len, hash);
+  }
+
+  __atomic_clear(&intern->lock, __ATOMIC_RELEASE);
+
+  return slot ? str_intern_string(slot) : str_null;
+}
+
+/**
+ * takes the writer lock, waiting writers poll with a pause for a short add
+ * and yield the cpu once the holder takes longer, e.g. to grow the table
+ * */
+static void str_intern_lock(str_intern_t *intern) {
+
+  while (__atomic_test_and_set(&intern->lock, __ATOMIC_ACQUIRE)) {
+    for (unsigned int spins = 0;
+         __atomic_load_n(&intern->lock, __ATOMIC_RELAXED); spins++) {
+      if (spins >= STR_INTERN_SPINS)
+        sched_yield();
+#ifdef STR_SIMD_X86
+      else
+        _mm_pause();
+#endif
+    }
+  }
+}
+
+/**
+ * returns the canonical copy of s or str_null if s was not interned yet,
+ * never locks or allocates
+ * */
+string_t str_intern_find(str_intern_t *intern, const string_t s) {
+
+  if (!intern)
+    return str_null;
+
+  const char *c = str_ptr(&s);
+
+  const char *slot =
+      str_intern_probe(__atomic_load_n(&intern->table, __ATOMIC_ACQUIRE), c,
+                       s.len, str_hash(s, 0));
+
+  return slot ? str_intern_string(slot) : str_null;
+}
+
+/**
+ * returns the hash str_intern computed for s, s has to be returned by
+ * str_intern or str_intern_find
+ * */
+uint64_t str_intern_hash(const string_t s) {
+  return ((const str_intern_head_t *)s.str - 1)->hash;
+}
+
+/**
+ * compares two strings interned in the same table
+ * */
+int str_intern_equals(const string_t s1, const string_t s2) {
+  return s1.str == s2.str;
+}
+
+/**
+ * linear probing, the table is at most half full so there always is an
+ * empty slot to stop at
+ * */
+static const char *str_intern_probe(const str_intern_table_t *table,
+                                    const char *c, size_t len, uint64_t hash) {
+
+  if (!table)
+    return (const char *)0;
+
+  for (size_t i = hash & table->mask;; i = (i + 1) & table->mask) {
+    const char *slot = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+
+    if (!slot)
+      return (const char *)0;
+
+    const str_intern_head_t *head = (const str_intern_head_t *)slot - 1;
+
+    if (head->hash == hash && head->len == len && !memcmp(slot, c, len))
+      return slot;
+  }
+}
+
+/**
+ * copies c into the arena and publishes it in table
+ * called with the lock held
+ * */
+static const char *str_intern_add(str_intern_t *intern,
+                                  str_intern_table_t *table, const char *c,
+                                  size_t len, uint64_t hash) {
+
+  if (!intern->arena)
+    intern->arena = str_arena_create(0);
+
+  if (!intern->arena)
+    return (const char *)0;
+
+  // headers stay aligned as long as every allocation is a multiple of 8
+  size_t size = (sizeof(str_intern_head_t) + len + 1 + 7) & ~(size_t)7;
+  char *mem = str_arena_alloc(intern->arena, size);
+
+  if (!mem)
+    return (const char *)0;
+
+  str_intern_head_t *head = (str_intern_head_t *)mem;
+  head->hash = hash;
+  head->len = len;
+
+  char *chr = mem + sizeof(str_intern_head_t);
+  memcpy(chr, c, len);
+  *(chr + len) = 0;
+
+  size_t i = hash & table->mask;
+  while (table->slots[i])
+    i = (i + 1) & table->mask;
+
+  // publishes the chars written above to the readers
+  __atomic_store_n(&table->slots[i], chr, __ATOMIC_RELEASE);
+  intern->count++;
+
+  return chr;
+}
+
+/**
+ * doubles the table, the old one is kept until str_intern_free because
+ * readers might still be probing it
+ * called with the lock held
+ * */
+static str_intern_table_t *str_intern_grow(str_intern_t *intern) {
+
+  str_intern_table_t *old = intern->table;
+  size_t slots = old ? (old->mask + 1) * 2 : STR_INTERN_MIN_SLOTS;
+
+  str_intern_table_t *table =
+      calloc(1, sizeof(str_intern_table_t) + slots * sizeof(const char *));
+
+  if (!table)
+    return (str_intern_table_t *)0;
+
+  table->mask = slots - 1;
+  table->prev = old;
+
+  for (size_t i = 0; old && i <= old->mask; i++) {
+    const char *slot = old->slots[i];
 
-    (*len)++;
+    if (!slot)
+      continue;
 
-    *arr = realloc(*arr, sizeof(string_t) * (*len + 1));
-    if (!arr)
-      return;
+    size_t j = ((const str_intern_head_t *)slot - 1)->hash & table->mask;
+    while (table->slots[j])
+      j = (j + 1) & table->mask;
+
+    table->slots[j] = slot;
   }
 
-  str_clone(*arr + *len, s);
-  (*len)++;
+  __atomic_store_n(&intern->table, table, __ATOMIC_RELEASE);
 
-  s.str = s_base;
+  return table;
 }
 
 /**
- * joins an array of strings into a string
+ * the string_t for interned chars, they are owned by the table's arena
  * */
-string_t str_implode(const string_t delimiter, string_t *arr, size_t len) {
+static string_t str_intern_string(const char *c) {
   string_t s = str_null;
 
-  strr_implode(&s, delimiter, arr, len);
+  s.str = (char *)c;
+  s.len = ((const str_intern_head_t *)c - 1)->len;
+  s.flags = STR_ARENA;
 
   return s;
 }
 
 /**
- * joins an array of strings into a string
+ * initializes an empty map, nothing is allocated until the first put
+ *
+ * keys are stored as given and not copied, the chars of borrowed or heap
+ * keys have to outlive their entry, inline keys are copied with the string_t
  * */
-string_t *strr_implode(string_t *s, const string_t delimiter, string_t *arr,
-                       size_t len) {
+void str_map_init(str_map_t *map, uint64_t seed) {
 
-  if (!s)
-    return s;
+  if (!map)
+    return;
 
-  if (len == 0)
-    return s;
+  map->ctrl = (signed char *)0;
+  map->entries = (str_map_entry_t *)0;
+  map->cap = 0;
+  map->len = 0;
+  map->growth_left = 0;
+  map->seed = seed;
+}
 
-  for (int i = 0; i < len; i++) {
-    string_t s_arr = *(arr + i);
+/**
+ * frees the table, keys and values are not freed
+ * */
+void str_map_free(str_map_t *map) {
 
-    strr_cat(s, "%S", s_arr);
+  if (!map)
+    return;
 
-    if (i != len - 1)
-      strr_cat(s, "%S", delimiter);
-  }
+  free(map->entries);
 
-  return s;
+  str_map_init(map, map->seed);
 }
 
 /**
- * replaces search with replace in the string
+ * inserts key or replaces the value if key is already in the map
+ * the map stores key as given, its chars are owned by the caller and have to
+ * outlive the map
+ * returns 0 if the allocation failed
  * */
-string_t str_replace(string_t s, const string_t search,
-                     const string_t replace) {
-  string_t s_new = str_null;
+int str_map_put(str_map_t *map, const string_t key, void *value) {
 
-  if (!*str_ptr(search))
-    return s;
+  if (!map)
+    return 0;
 
-  size_t pos;
-  while ((pos = str_pos(s, search)) != -1) {
+  str_map_entry_t *entry = str_map_find(map, key);
 
-    if (pos != 0) {
-      // add everything up to the "search"
-      str_mem_append(&s_new, s.str, pos);
-    }
+  if (entry) {
+    entry->value = value;
+    return 1;
+  }
 
-    // add the replace
-    str_mem_append(&s_new, replace.str, replace.len);
+  uint64_t hash = str_hash(key, map->seed);
+  size_t i = map->cap ? str_map_find_free(map, hash) : 0;
+
+  // reusing a tombstone doesn't use up growth
+  if (!map->cap || (!map->growth_left && map->ctrl[i] == STR_MAP_EMPTY)) {
+    // mostly tombstones: rehash at the same size
+    size_t cap = !map->cap                   ? STR_MAP_GROUP
+                 : map->len * 16 < map->cap * 7 ? map->cap
+                                                : map->cap * 2;
 
-    s.str += pos + search.len;
-    s.len -= pos + search.len;
+    if (!str_map_resize(map, cap))
+      return 0;
+
+    i = str_map_find_free(map, hash);
   }
 
-  // add the rest
-  str_mem_append(&s_new, s.str, s.len);
+  if (map->ctrl[i] == STR_MAP_EMPTY)
+    map->growth_left--;
 
-  return s_new;
+  str_map_set_ctrl(map, i, (signed char)(hash & 0x7f));
+
+  map->entries[i].key = key;
+  map->entries[i].value = value;
+  map->len++;
+
+  return 1;
 }
 
 /**
- * replaces search with replace in the string
+ * returns the entry of key or (str_map_entry_t *)0 if key is not in the map
+ *
+ * the group a key hashes to is compared against the key's 7 bit tag at once,
+ * only matching slots compare the key itself
  * */
-string_t *strr_replace(string_t *s, const string_t search,
-                       const string_t replace) {
+str_map_entry_t *str_map_find(const str_map_t *map, const string_t key) {
 
-  if (!s)
-    return s;
+  if (!map || !map->cap)
+    return (str_map_entry_t *)0;
 
-  if (!*str_ptr(search))
-    return s;
+  uint64_t hash = str_hash(key, map->seed);
+  signed char h = (signed char)(hash & 0x7f);
+  const char *c = str_ptr(&key);
 
-  str_auto s_cpy;
-  str_clone(&s_cpy, *s);
-  char *s_cpy_chr = s_cpy.str;
+  size_t mask = map->cap - 1;
+  size_t pos = (size_t)(hash >> 7) & mask;
 
-  str_free(s);
-  *s = str_null;
+  // triangular probing visits every group once for power of two sizes
+  for (size_t stride = STR_MAP_GROUP;; stride += STR_MAP_GROUP) {
+    const signed char *group = map->ctrl + pos;
 
-  size_t pos;
-  while ((pos = str_pos(s_cpy, search)) != -1) {
+    unsigned int match = str_map_match(group, h);
+    while (match) {
+      size_t i = (pos + (size_t)__builtin_ctz(match)) & mask;
+      str_map_entry_t *entry = map->entries + i;
 
-    if (pos != 0) {
-      // add everything up to the "search"
-      str_mem_append(s, s_cpy.str, pos);
+      if (entry->key.len == key.len &&
+          !memcmp(str_ptr(&entry->key), c, key.len))
+        return entry;
+
+      match &= match - 1;
     }
 
-    // add the replace
-    str_mem_append(s, replace.str, replace.len);
+    if (str_map_match(group, STR_MAP_EMPTY))
+      return (str_map_entry_t *)0;
 
-    s_cpy.str += pos + search.len;
-    s_cpy.len -= pos + search.len;
+    pos = (pos + stride) & mask;
   }
+}
 
-  // add the rest
-  str_mem_append(s, s_cpy.str, s_cpy.len);
-
-  s_cpy.str = s_cpy_chr;
+/**
+ * returns the value of key or (void *)0 if key is not in the map
+ * */
+void *str_map_get(const str_map_t *map, const string_t key) {
+  str_map_entry_t *entry = str_map_find(map, key);
 
-  return s;
+  return entry ? entry->value : (void *)0;
 }
 
 /**
- * get the substring of a string using offset and length
+ * removes key from the map
+ * returns 0 if key was not in the map
  * */
-string_t str_substr(string_t s, ssize_t offset, ssize_t len) {
-  string_t s_new = str_null;
+int str_map_remove(str_map_t *map, const string_t key) {
 
-  str_clone(&s_new, s);
+  str_map_entry_t *entry = str_map_find(map, key);
 
-  strr_substr(&s_new, offset, len);
+  if (!entry)
+    return 0;
 
-  return s_new;
+  size_t mask = map->cap - 1;
+  size_t i = (size_t)(entry - map->entries);
+
+  unsigned int empty_after = str_map_match(map->ctrl + i, STR_MAP_EMPTY);
+  unsigned int empty_before = str_map_match(
+      map->ctrl + ((i - STR_MAP_GROUP) & mask), STR_MAP_EMPTY);
+
+  // if no group wide window around i was ever full, probes never passed i
+  // and the slot can become empty again instead of a tombstone
+  if (empty_before && empty_after &&
+      (size_t)(__builtin_clz(empty_before) - (32 - STR_MAP_GROUP)) +
+              (size_t)__builtin_ctz(empty_after) <
+          STR_MAP_GROUP) {
+    str_map_set_ctrl(map, i, STR_MAP_EMPTY);
+    map->growth_left++;
+  } else {
+    str_map_set_ctrl(map, i, STR_MAP_DELETED);
+  }
+
+  map->entries[i] = (str_map_entry_t){0};
+  map->len--;
+
+  return 1;
 }
 
 /**
- * get the substring of a string using offset and length
+ * iterates the entries, *pos has to be 0 for the first call
+ * returns (str_map_entry_t *)0 after the last entry
  * */
-string_t *strr_substr(string_t *s, ssize_t offset, ssize_t len) {
+str_map_entry_t *str_map_next(const str_map_t *map, size_t *pos) {
 
-  if (!s)
-    return s;
+  if (!map || !pos)
+    return (str_map_entry_t *)0;
 
-  if (offset >= (ssize_t)s->len || (offset < 0 && len < offset)) {
-    str_free(s);
-    *s = str_null;
-    return s;
+  for (; *pos < map->cap; (*pos)++) {
+    if (map->ctrl[*pos] >= 0)
+      return map->entries + (*pos)++;
   }
 
-  if (len > (ssize_t)s->len)
-    len = (ssize_t)s->len;
+  return (str_map_entry_t *)0;
+}
 
-  if (offset < 0) {
-    offset = (ssize_t)s->len + offset;
-    if (offset < 0)
-      offset = 0;
-  }
-  if (len < 0)
-    len = (ssize_t)s->len + len - offset;
+/**
+ * bit i is set if control byte i of the group is h
+ * */
+static inline unsigned int str_map_match(const signed char *ctrl,
+                                         signed char h) {
+#ifdef STR_SIMD_X86
+  __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
 
-  char *tmp = malloc(len + 1);
+  return (unsigned int)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(group, _mm_set1_epi8(h)));
+#else
+  unsigned int mask = 0;
 
-  if (!tmp)
-    return s;
+  for (int i = 0; i < STR_MAP_GROUP; i++)
+    mask |= (unsigned int)(ctrl[i] == h) << i;
 
-  memcpy(tmp, s->str + offset, len);
+  return mask;
+#endif
+}
 
-  *(tmp + len) = 0;
+/**
+ * bit i is set if slot i of the group is empty or deleted, both have the
+ * sign bit set
+ * */
+static inline unsigned int str_map_match_free(const signed char *ctrl) {
+#ifdef STR_SIMD_X86
+  return (unsigned int)_mm_movemask_epi8(
+      _mm_loadu_si128((const __m128i *)ctrl));
+#else
+  unsigned int mask = 0;
 
-  free(s->str);
+  for (int i = 0; i < STR_MAP_GROUP; i++)
+    mask |= (unsigned int)(ctrl[i] < 0) << i;
 
-  s->str = tmp;
-  s->len = len;
+  return mask;
+#endif
+}
 
-  return s;
+/**
+ * sets control byte i and its mirror behind the end of the table
+ * */
+static void str_map_set_ctrl(str_map_t *map, size_t i, signed char h) {
+  map->ctrl[i] = h;
+
+  if (i < STR_MAP_GROUP)
+    map->ctrl[map->cap + i] = h;
 }
 
 /**
- * remove whitespaces at the end and the front
+ * the first empty or deleted slot on the probe sequence of hash
  * */
-string_t str_trim(const string_t s) {
-  string_t s_new = str_null;
+static size_t str_map_find_free(const str_map_t *map, uint64_t hash) {
+  size_t mask = map->cap - 1;
+  size_t pos = (size_t)(hash >> 7) & mask;
 
-  str_clone(&s_new, s);
+  for (size_t stride = STR_MAP_GROUP;; stride += STR_MAP_GROUP) {
+    unsigned int free_mask = str_map_match_free(map->ctrl + pos);
 
-  strr_trim(&s_new);
+    if (free_mask)
+      return (pos + (size_t)__builtin_ctz(free_mask)) & mask;
 
-  return s_new;
+    pos = (pos + stride) & mask;
+  }
 }
 
 /**
- * remove whitespaces at the end and the front
+ * rehashes all entries into a table of cap slots (a power of two), which
+ * also drops the tombstones
+ * entries and control bytes share one allocation
+ * returns 0 if the allocation failed
  * */
-string_t *strr_trim(string_t *s) {
+static int str_map_resize(str_map_t *map, size_t cap) {
 
-  if (!s)
-    return s;
+  str_map_t old = *map;
 
-  size_t len = s->len;
-  char *c = s->str;
-  char *c_end = s->str + len - 1;
+  str_map_entry_t *entries =
+      malloc(cap * sizeof(str_map_entry_t) + cap + STR_MAP_GROUP);
 
-  str_heapify(s);
+  if (!entries)
+    return 0;
 
-  while (str_chr_is_ws(c) && len > 0) {
-    c++, len--;
+  map->entries = entries;
+  map->ctrl = (signed char *)(entries + cap);
+  map->cap = cap;
+  map->growth_left = cap - cap / 8 - map->len;
+
+  memset(map->ctrl, STR_MAP_EMPTY, cap + STR_MAP_GROUP);
+
+  for (size_t i = 0; i < old.cap; i++) {
+    if (old.ctrl[i] < 0)
+      continue;
+
+    uint64_t hash = str_hash(old.entries[i].key, map->seed);
+    size_t j = str_map_find_free(map, hash);
+
+    str_map_set_ctrl(map, j, old.ctrl[i]);
+    map->entries[j] = old.entries[i];
   }
 
-  while (str_chr_is_ws(c_end) && len > 0) {
-    c_end--, len--;
+  free(old.entries);
+
+  return 1;
+}
+
+/**
+ * initializes an empty builder
+ *
+ * the pieces are only joined by str_builder_finish, which allocates the
+ * result once with its exact size, or written to a file descriptor by
+ * str_builder_write without being joined at all
+ * */
+void str_builder_init(str_builder_t *b) {
+
+  if (!b)
+    return;
+
+  b->pieces = (str_piece_t *)0;
+  b->n = 0;
+  b->cap = 0;
+  b->len = 0;
+}
+
+/**
+ * frees the pieces, borrowed chars are left alone
+ * */
+void str_builder_free(str_builder_t *b) {
+
+  if (!b)
+    return;
+
+  for (size_t i = 0; i < b->n; i++) {
+    if (b->pieces[i].owned)
+      free((char *)b->pieces[i].ptr);
   }
 
-  char *tmp = malloc(len + 1);
+  free(b->pieces);
 
-  if (!tmp)
-    return s;
+  str_builder_init(b);
+}
 
-  memcpy(tmp, c, len);
+/**
+ * appends s, inline strings are copied, the chars of other strings are
+ * borrowed and have to stay valid until the builder is finished or written
+ * returns 0 if the allocation failed
+ * */
+int str_builder_add(str_builder_t *b, const string_t s) {
 
-  *(tmp + len) = 0;
+  if (!b)
+    return 0;
 
-  free(s->str);
+  if (!s.len)
+    return 1;
 
-  s->str = tmp;
-  s->len = len;
+  str_piece_t *piece = str_builder_piece(b, s.len);
 
-  return s;
+  if (!piece)
+    return 0;
+
+  if (s.flags & STR_SSO)
+    memcpy(piece->buf, s.sso, s.len);
+  else
+    piece->ptr = s.str;
+
+  return 1;
 }
 
 /**
- * remove whitespaces at the end
+ * appends the decimal representation of value
+ * returns 0 if the allocation failed
  * */
-string_t str_rtrim(const string_t s) {
-  string_t s_new = str_null;
+int str_builder_int(str_builder_t *b, long long value) {
 
-  str_clone(&s_new, s);
+  if (!b)
+    return 0;
 
-  strr_rtrim(&s_new);
+  int negative = value < 0;
+  uint64_t magnitude = negative ? 0ull - (uint64_t)value : (uint64_t)value;
 
-  return s_new;
+  str_piece_t *piece = str_builder_piece(b, 0);
+
+  if (!piece)
+    return 0;
+
+  if (negative)
+    *piece->buf = '-';
+
+  piece->len = (size_t)negative + str_fmt_u64(piece->buf + negative, magnitude);
+  b->len += piece->len;
+
+  return 1;
 }
 
 /**
- * remove whitespaces at the end
+ * appends the decimal representation of value
+ * returns 0 if the allocation failed
  * */
-string_t *strr_rtrim(string_t *s) {
+int str_builder_uint(str_builder_t *b, unsigned long long value) {
 
-  if (!s)
-    return s;
+  if (!b)
+    return 0;
 
-  size_t len = s->len;
-  char *c = s->str;
-  char *c_end = s->str + len - 1;
+  str_piece_t *piece = str_builder_piece(b, 0);
 
-  if (!(*c))
-    return s;
+  if (!piece)
+    return 0;
+
+  piece->len = str_fmt_u64(piece->buf, value);
+  b->len += piece->len;
+
+  return 1;
+}
+
+/**
+ * appends n times c, e.g. for padding, only c and n are stored
+ * returns 0 if the allocation failed
+ * */
+int str_builder_fill(str_builder_t *b, char c, size_t n) {
+
+  if (!b)
+    return 0;
 
-  str_heapify(s);
+  if (!n)
+    return 1;
+
+  str_piece_t *piece = str_builder_piece(b, n);
+
+  if (!piece)
+    return 0;
 
-  while (str_chr_is_ws(c_end) && len > 0) {
-    c_end--, len--;
+  if (n < STR_PIECE_SIZE) {
+    memset(piece->buf, c, n);
+  } else {
+    *piece->buf = c;
+    piece->fill = 1;
   }
 
-  char *tmp = malloc(len + 1);
+  return 1;
+}
 
-  if (!tmp)
-    return s;
+/**
+ * appends a formatted string (see str_format), it is formatted right away
+ * returns 0 if the allocation failed
+ * */
+int str_builder_cat(str_builder_t *b, char *str, ...) {
+
+  if (!b)
+    return 0;
 
-  memcpy(tmp, s->str, len);
+  va_list args;
+  va_start(args, str);
 
-  *(tmp + len) = 0;
+  va_list args_len;
+  va_copy(args_len, args);
 
-  free(s->str);
+  size_t len = str_format((char *)0, str, args_len);
 
-  s->str = tmp;
-  s->len = len;
+  va_end(args_len);
 
-  return s;
+  char *c = (char *)0;
+  str_piece_t *piece = (str_piece_t *)0;
+
+  if (len < STR_PIECE_SIZE || (c = malloc(len)))
+    piece = str_builder_piece(b, len);
+
+  if (piece) {
+    if (c) {
+      piece->ptr = c;
+      piece->owned = 1;
+    }
+
+    str_format(c ? c : piece->buf, str, args);
+  } else {
+    free(c);
+  }
+
+  va_end(args);
+
+  return piece != (str_piece_t *)0;
 }
 
 /**
- * remove whitespaces at the front
+ * joins the pieces into a string with a single allocation and resets the
+ * builder
  * */
-string_t str_ltrim(const string_t s) {
-  string_t s_new = str_null;
+string_t str_builder_finish(str_builder_t *b) {
 
-  str_clone(&s_new, s);
+  if (!b)
+    return str_null;
 
-  strr_ltrim(&s_new);
+  string_t s;
+  char *c = str_init_len(&s, b->len);
 
-  return s_new;
+  if (!c)
+    return str_null;
+
+  for (size_t i = 0; i < b->n; i++) {
+    const str_piece_t *piece = b->pieces + i;
+
+    if (piece->fill)
+      memset(c, *piece->buf, piece->len);
+    else
+      memcpy(c, piece->ptr ? piece->ptr : piece->buf, piece->len);
+
+    c += piece->len;
+  }
+
+  str_builder_free(b);
+
+  return s;
 }
 
 /**
- * remove whitespaces at the front
+ * writes the pieces to fd with writev, without joining them first
+ * returns the number of bytes written or -1 on an error
  * */
-string_t *strr_ltrim(string_t *s) {
+ssize_t str_builder_write(const str_builder_t *b, int fd) {
 
-  if (!s)
-    return s;
+  if (!b)
+    return -1;
+
+  struct iovec iov[STR_BUILDER_IOV];
+  char run[STR_BUILDER_RUN];
+
+  // the first piece that is not completely written and how much of it is
+  size_t piece = 0, offset = 0, written = 0;
+
+  while (piece < b->n) {
+    size_t n = 0;
+    // char of the fill runs of this call, run is repeated for them
+    int run_c = -1;
+
+    for (size_t i = piece; i < b->n && n < STR_BUILDER_IOV; i++) {
+      const str_piece_t *p = b->pieces + i;
+      size_t skip = i == piece ? offset : 0;
+
+      if (!p->fill) {
+        iov[n].iov_base = (char *)(p->ptr ? p->ptr : p->buf) + skip;
+        iov[n++].iov_len = p->len - skip;
+        continue;
+      }
+
+      // a run of another char waits for the next call
+      if (run_c != -1 && run_c != (unsigned char)*p->buf)
+        break;
+
+      if (run_c == -1) {
+        run_c = (unsigned char)*p->buf;
+        memset(run, run_c, sizeof(run));
+      }
+
+      for (size_t left = p->len - skip; left && n < STR_BUILDER_IOV;) {
+        size_t k = left < sizeof(run) ? left : sizeof(run);
+
+        iov[n].iov_base = run;
+        iov[n++].iov_len = k;
+        left -= k;
+      }
+    }
+
+    ssize_t w = writev(fd, iov, (int)n);
+
+    if (w < 0) {
+      if (errno == EINTR)
+        continue;
+
+      return -1;
+    }
+
+    written += (size_t)w;
+
+    // skip what was written, possibly ending inside a piece
+    size_t left = (size_t)w;
+    while (piece < b->n && left >= b->pieces[piece].len - offset) {
+      left -= b->pieces[piece].len - offset;
+      offset = 0;
+      piece++;
+    }
+
+    offset += left;
+  }
+
+  return (ssize_t)written;
+}
+
+/**
+ * appends a piece of len chars, the caller fills in the chars
+ * */
+static str_piece_t *str_builder_piece(str_builder_t *b, size_t len) {
 
-  str_heapify(s);
+  if (b->n == b->cap) {
+    size_t cap = b->cap ? b->cap * 2 : 16;
+    str_piece_t *pieces = realloc(b->pieces, cap * sizeof(str_piece_t));
 
-  char *c = s->str;
+    if (!pieces)
+      return (str_piece_t *)0;
 
-  size_t start = 0;
-  size_t len = s->len;
-  while (str_chr_is_ws(c) && len > 0) {
-    c++, len--;
+    b->pieces = pieces;
+    b->cap = cap;
   }
 
-  char *tmp = malloc(len + 1);
+  str_piece_t *piece = b->pieces + b->n++;
 
-  if (!tmp)
-    return s;
-
-  memcpy(tmp, c, len);
+  piece->ptr = (const char *)0;
+  piece->len = len;
+  piece->owned = 0;
+  piece->fill = 0;
 
-  *(tmp + len) = 0;
+  b->len += len;
 
-  free(s->str);
+  return piece;
+}
 
-  s->str = tmp;
-  s->len = len;
+#ifdef CSTRING_PARALLEL
 
-  return s;
-}
+/*
+ * the input is split into chunks that worker threads take from a shared
+ * counter, a chunk owns the matches that start inside it and reads up to
+ * m - 1 bytes into the next one
+ *
+ * a chunk is scanned greedily from its start, but the sequential scan may
+ * enter it a few bytes later when the last match of the previous chunk
+ * crosses the border, str_parallel_stitch rescans from there until it hits
+ * one of the chunk's own matches, from which on both scans agree
+ * */
 
 /**
- * reverse the string
+ * returns the position of the first occurence of search in s using threads
+ * threads (0 for one per cpu), same result as str_pos
  * */
-string_t str_rev(const string_t s) {
-  string_t s_new = str_null;
+size_t str_pos_parallel(string_t s, const string_t search,
+                        unsigned int threads) {
+  str_parallel_job_t job;
 
-  char *c = str_ptr(s);
+  if (!str_parallel_init(&job, &s, &search, &threads))
+    return str_pos(s, search);
 
-  if (!*c)
-    return s_new;
+  job.op = STR_PARALLEL_POS;
+  str_parallel_run(&job, threads);
 
-  str_clone(&s_new, s);
+  size_t pos = job.found < job.nchunks ? job.chunks[job.found].sync[0] : -1;
 
-  strr_rev(&s_new);
+  free(job.chunks);
 
-  return s_new;
+  return pos;
 }
 
 /**
- * reverse the string
+ * counts the occurences of search in s using threads threads (0 for one per
+ * cpu), same result as str_count
  * */
-string_t *strr_rev(string_t *s) {
-
-  if (!s || !s->str)
-    return s;
-
-  str_heapify(s);
+size_t str_count_parallel(string_t s, const string_t search,
+                          unsigned int threads) {
+  str_parallel_job_t job;
 
-  char *tmp = malloc(s->len);
-
-  if (!tmp)
-    return s;
+  if (!str_parallel_init(&job, &s, &search, &threads))
+    return str_count(s, search);
 
-  memcpy(tmp, s->str, s->len);
+  job.op = STR_PARALLEL_COUNT;
+  str_parallel_run(&job, threads);
 
-  int j = 0;
-  for (int i = s->len - 1; i >= 0; i--, j++)
-    s->str[i] = tmp[j];
+  size_t count = str_parallel_stitch(&job);
 
-  free(tmp);
+  free(job.chunks);
 
-  return s;
+  return count;
 }
 
-//  TODO: pad with UTF8-chars
 /**
- * pad the string to len by prepending c
+ * replaces search with replace in the string using threads threads (0 for
+ * one per cpu), same result as str_replace
+ *
+ * the matches are counted in parallel first, so every chunk knows where its
+ * output starts and the result is written by all threads into one buffer
  * */
-string_t str_lpad(string_t s, char c, size_t len) {
+string_t str_replace_parallel(string_t s, const string_t search,
+                              const string_t replace, unsigned int threads) {
+  str_parallel_job_t job;
+
+  if (!str_parallel_init(&job, &s, &search, &threads))
+    return str_replace(s, search, replace);
+
+  job.op = STR_PARALLEL_COUNT;
+  str_parallel_run(&job, threads);
+
+  size_t count = str_parallel_stitch(&job);
+
   string_t s_new;
+  char *c = str_init_len(&s_new, job.n - count * job.m + count * replace.len);
 
-  str_clone(&s_new, s);
+  if (c) {
+    job.op = STR_PARALLEL_REPLACE;
+    job.replace = str_ptr(&replace);
+    job.r = replace.len;
+    job.dst = c;
 
-  strr_lpad(&s_new, c, len);
+    str_parallel_run(&job, threads);
+  } else {
+    s_new = str_null;
+  }
+
+  free(job.chunks);
 
   return s_new;
 }
 
 /**
- * pad the string to len by prepending c
+ * splits s into chunks
+ * returns 0 if the sequential version should be used instead
  * */
-string_t *strr_lpad(string_t *s, char c, size_t len) {
+static int str_parallel_init(str_parallel_job_t *job, string_t *s,
+                             const string_t *search, unsigned int *threads) {
 
-  if (!s)
-    return s;
-
-  str_heapify(s);
-
-  if (s->len < len) {
-    size_t padding = len - s->len;
-    char *tmp = malloc(padding);
-
-    if (!tmp)
-      return s;
+  if (!*threads) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    *threads = cpus > 0 ? (unsigned int)cpus : 1;
+  }
 
-    memset(tmp, c, padding);
+  if (*threads < 2 || !search->len || s->len < STR_PARALLEL_MIN)
+    return 0;
 
-    string_t s_tmp = str_acquire_s(tmp, padding);
+  // a chunk has to be long enough to hold a whole match
+  size_t chunk =
+      search->len > STR_PARALLEL_CHUNK ? search->len : STR_PARALLEL_CHUNK;
 
-    strr_cat(&s_tmp, "%S", *s);
+  *job = (str_parallel_job_t){0};
+  job->text = str_ptr(s);
+  job->n = s->len;
+  job->needle = str_ptr(search);
+  job->m = search->len;
+  job->nchunks = (s->len + chunk - 1) / chunk;
+  job->chunks = calloc(job->nchunks, sizeof(str_parallel_chunk_t));
 
-    str_free(s);
+  if (!job->chunks)
+    return 0;
 
-    *s = s_tmp;
+  for (size_t i = 0; i < job->nchunks; i++) {
+    job->chunks[i].start = i * chunk;
+    job->chunks[i].end = i + 1 < job->nchunks ? (i + 1) * chunk : s->len;
   }
 
-  return s;
+  return 1;
 }
 
-// TODO: pad with UTF8-chars
 /**
- * pad the string to len by appending c
+ * processes all chunks of the job on threads - 1 workers and the calling
+ * thread, chunks of workers that fail to start are taken by the others
  * */
-string_t str_rpad(string_t s, char c, size_t len) {
-  string_t s_new;
-
-  str_clone(&s_new, s);
+static void str_parallel_run(str_parallel_job_t *job, unsigned int threads) {
 
-  strr_rpad(&s_new, c, len);
+  job->next = 0;
+  job->found = -1;
 
-  return s_new;
+  str_parallel_spawn(str_parallel_worker, job, threads);
 }
 
 /**
- * pad the string to len by appending c
+ * runs fn(arg) on threads - 1 workers and the calling thread, fn has to take
+ * its work from arg until there is none left
  * */
-string_t *strr_rpad(string_t *s, char c, size_t len) {
+static void str_parallel_spawn(thread_fn_t fn, void *arg,
+                               unsigned int threads) {
 
-  if (!s)
-    return s;
+  thread_t *workers = calloc(threads - 1, sizeof(thread_t));
+  size_t started = 0;
 
-  str_heapify(s);
+  for (unsigned int i = 0; workers && i < threads - 1; i++) {
+    thread_t *t = workers + started;
 
-  if (s->len < len) {
-    size_t padding = len - s->len;
-    char *tmp = malloc(padding);
+    t->fn = fn;
+    t->arg = arg;
 
-    if (!tmp)
-      return s;
+    if (pthread_attr_init(&t->attr) != 0)
+      break;
 
-    memset(tmp, c, padding);
+    int err = thread_start(t);
+    pthread_attr_destroy(&t->attr);
 
-    str_auto s_tmp = str_acquire_s(tmp, padding);
+    if (err)
+      break;
 
-    strr_cat(s, "%S", s_tmp);
+    started++;
   }
 
-  return s;
-}
+  fn(arg);
 
-/**
- * initialize the tokenizer
- * */
-tokenizer_t str_token_init(string_t s, const string_t delimiter) {
-  tokenizer_t tok = {.delimiter = delimiter,
-                     .base = s,
-                     .start = s.str,
-                     .end = ((char *)s.str + s.len - 1)};
+  for (size_t i = 0; i < started; i++)
+    thread_join(workers + i, (void **)0);
 
-  return tok;
+  free(workers);
 }
 
-/**
- * get the next token from the tokenizer
- * */
-char str_token_next(tokenizer_t *tok, string_t *s) {
+static void *str_parallel_worker(void *arg) {
+  str_parallel_job_t *job = arg;
 
-  if (!tok)
-    return 0;
+  for (;;) {
+    size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
 
-  if (!s)
-    return 0;
+    if (i >= job->nchunks)
+      break;
 
-  str_free(s);
+    str_parallel_chunk_t *c = job->chunks + i;
 
-  size_t pos;
-  pos = str_pos(tok->base, tok->delimiter);
+    if (job->op == STR_PARALLEL_REPLACE) {
+      str_parallel_replace_chunk(job, c);
+      continue;
+    }
 
-  // return whole string
-  if (pos == -1)
-    *s = str_acquire_s(tok->base.str, tok->base.len);
+    // a chunk before this one already has a match
+    if (job->op == STR_PARALLEL_POS &&
+        i > __atomic_load_n(&job->found, __ATOMIC_RELAXED))
+      continue;
 
-  while (tok->base.str <= tok->end) {
-    if (pos > 0) {
-      str_clone_from_chr(s, tok->base.str, pos);
-      tok->base.str += pos + 1;
-      return 1;
-    } else {
-      tok->base.str += tok->delimiter.len;
-      pos = str_pos(tok->base, tok->delimiter);
+    str_parallel_scan(job, c);
+
+    if (job->op == STR_PARALLEL_POS && c->count) {
+      size_t found = __atomic_load_n(&job->found, __ATOMIC_RELAXED);
+
+      while (i < found &&
+             !__atomic_compare_exchange_n(&job->found, &found, i, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
     }
   }
 
-  return 0;
+  return (void *)0;
 }
 
 /**
- * clones the given string into the pointer
- * clones the char* aswell
+ * greedy scan of the chunk from its start, only the first match for pos
  * */
-void str_clone(string_t *target, string_t s) {
+static void str_parallel_scan(const str_parallel_job_t *job,
+                              str_parallel_chunk_t *c) {
+  size_t limit = c->end + job->m - 1 < job->n ? c->end + job->m - 1 : job->n;
+  size_t p = c->start;
 
-  if (!target)
-    return;
+  c->count = 0;
+  c->last_end = c->start;
 
-  char *new_str = malloc(s.len + 1);
+  size_t q;
+  while ((q = str_find(job->text + p, limit - p, job->needle, job->m, 0)) !=
+         -1) {
+    q += p;
 
-  if (!new_str)
-    return;
+    if (c->count < STR_PARALLEL_SYNC)
+      c->sync[c->count] = q;
 
-  memcpy(new_str, str_ptr(s), s.len);
+    c->count++;
+    p = c->last_end = q + job->m;
 
-  target->str = new_str;
-  target->len = s.len;
-  target->flags = STR_OWNER | STR_HEAP;
+    if (job->op == STR_PARALLEL_POS)
+      break;
+  }
+}
+
+/**
+ * writes the output of the chunk, from where the sequential scan enters it
+ * up to where it enters the next one
+ * */
+static void str_parallel_replace_chunk(const str_parallel_job_t *job,
+                                       const str_parallel_chunk_t *c) {
+  size_t limit = c->end + job->m - 1 < job->n ? c->end + job->m - 1 : job->n;
+  size_t next = c + 1 < job->chunks + job->nchunks ? (c + 1)->entry : job->n;
+
+  // every match before the chunk replaced m input bytes with r output bytes
+  char *out = job->dst + c->entry - c->before * job->m + c->before * job->r;
+  size_t p = c->entry, q;
+
+  while (p < c->end &&
+         (q = str_find(job->text + p, limit - p, job->needle, job->m, 0)) !=
+             -1) {
+    memcpy(out, job->text + p, q);
+    out += q;
+    memcpy(out, job->replace, job->r);
+    out += job->r;
+
+    p += q + job->m;
+  }
 
-  *(target->str + s.len) = 0;
+  if (next > p)
+    memcpy(out, job->text + p, next - p);
 }
 
 /**
- * clones the given char* and creates a new string with it
+ * walks the chunks in order, fixes up the ones the sequential scan enters
+ * after their start and sets entry and before of every chunk
+ * returns the total number of matches
  * */
-void str_clone_from_chr(string_t *target, char *c, size_t len) {
+static size_t str_parallel_stitch(str_parallel_job_t *job) {
+  size_t entry = 0, total = 0;
 
-  if (!target)
-    return;
+  for (size_t i = 0; i < job->nchunks; i++) {
+    str_parallel_chunk_t *c = job->chunks + i;
 
-  char *new_str = malloc(len + 1);
+    c->entry = entry;
+    c->before = total;
 
-  if (!new_str)
-    return;
+    if (c->entry == c->start) {
+      total += c->count;
+      entry = c->last_end > c->end ? c->last_end : c->end;
+      continue;
+    }
 
-  memcpy(new_str, c, len);
+    size_t limit = c->end + job->m - 1 < job->n ? c->end + job->m - 1 : job->n;
+    size_t sync = c->count < STR_PARALLEL_SYNC ? c->count : STR_PARALLEL_SYNC;
+    size_t p = c->entry, last = c->entry, j = 0, q;
 
-  target->str = new_str;
-  target->len = len;
-  target->flags = STR_OWNER | STR_HEAP;
+    while (p < c->end &&
+           (q = str_find(job->text + p, limit - p, job->needle, job->m, 0)) !=
+               -1) {
+      q += p;
 
-  *(target->str + len) = 0;
+      while (j < sync && c->sync[j] < q)
+        j++;
+
+      // both scans agree from here on
+      if (j < sync && c->sync[j] == q) {
+        total += c->count - j;
+        last = c->last_end;
+        break;
+      }
+
+      total++;
+      p = last = q + job->m;
+    }
+
+    entry = last > c->end ? last : c->end;
+  }
+
+  return total;
 }
 
 /**
- * creates a string from the given format
- *
- * supported formats:
- *
- * %d: int
- * %l: long
- * %s: char* string
- * %S: string_t string
+ * str_sort on threads (0 for one per cpu)
  *
+ * the items are distributed into buckets by their first 2 bytes, which are
+ * already in the right order, and the workers sort whole buckets
  * */
-static string_t str_from_format(char *str, va_list args) {
+void str_sort_parallel(string_t *arr, size_t len, unsigned int threads) {
 
-  string_t s = {.str = (void *)0, .len = 0, .flags = STR_OWNER | STR_HEAP};
+  if (!threads) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cpus > 0 ? (unsigned int)cpus : 1;
+  }
 
-  size_t len = 0;
+  if (!arr || threads < 2 || len < STR_SORT_PARALLEL_MIN) {
+    str_sort(arr, len);
+    return;
+  }
 
-  int arg_int;
-  long arg_long;
-  string_t arg_str;
-  char *arg_c_str;
-  char arg_c;
+  str_sort_item_t *items = str_sort_items(arr, len);
+  str_sort_item_t *sorted = malloc(len * sizeof(str_sort_item_t));
+  size_t *bucket = calloc(STR_SORT_BUCKETS + 1, sizeof(size_t));
 
-  while (*str) {
-    if (*str == '%') {
-      str++;
+  if (!items || !sorted || !bucket) {
+    free(items);
+    free(sorted);
+    free(bucket);
 
-      int tmp_len = 0;
-      int factor;
-      switch (*str) {
-      case 'd':
-        arg_int = va_arg(args, int);
-        tmp_len = 1;
-        factor = 10;
-        while (factor < arg_int) {
-          factor *= 10;
-          tmp_len++;
-        }
-
-        len += tmp_len;
-
-        s.str = realloc(s.str, len);
-        factor /= 10;
-        for (int i = 0; i < tmp_len; i++) {
-          s.str[s.len + i] = '0' + (arg_int / factor);
-          arg_int -= (arg_int / factor) * factor;
-          factor /= 10;
-        }
-        s.len += tmp_len;
-        break;
-      case 'l':
-        arg_long = va_arg(args, long);
-        tmp_len = 1;
-        factor = 10;
-        while (factor < arg_long) {
-          factor *= 10;
-          tmp_len++;
-        }
-        len += tmp_len;
-
-        s.str = realloc(s.str, len);
-        factor /= 10;
-        for (int i = 0; i < tmp_len; i++) {
-          s.str[s.len + i] = '0' + (arg_long / factor);
-          arg_long -= (arg_long / factor) * factor;
-          factor /= 10;
-        }
-        s.len += tmp_len;
-        break;
-      case 'S':
-        arg_str = va_arg(args, string_t);
-        len += arg_str.len;
+    str_sort(arr, len);
+    return;
+  }
 
-        str_mem_append(&s, arg_str.str, arg_str.len);
-        break;
-      case 's':
-        arg_c_str = va_arg(args, char *);
-        while (*arg_c_str) {
-          tmp_len++, arg_c_str++;
-        }
-        len += tmp_len;
-
-        str_mem_append(&s, arg_c_str - tmp_len, tmp_len);
-        break;
-      default:
-        break;
-      }
-      str++;
-      continue;
+  for (size_t i = 0; i < len; i++)
+    bucket[(items[i].key >> 48) + 1]++;
 
-    } else {
-      char *str_start = str;
-      while (*str && *str != '%') {
-        str++, len++;
-        if (!*str || *str == '%') {
-          str_mem_append(&s, str_start, str - str_start);
-        }
-      }
-    }
-  }
+  for (size_t i = 0; i < STR_SORT_BUCKETS; i++)
+    bucket[i + 1] += bucket[i];
 
-  // add null byte
-  s.str = realloc(s.str, len + 1);
+  // bucket[i] is the next free slot of bucket i while distributing
+  for (size_t i = 0; i < len; i++)
+    sorted[bucket[items[i].key >> 48]++] = items[i];
 
-  if (!s.str)
-    return str_null;
+  memmove(bucket + 1, bucket, STR_SORT_BUCKETS * sizeof(size_t));
+  bucket[0] = 0;
 
-  *(s.str + s.len) = 0;
+  str_sort_job_t job = {
+      .items = sorted, .arr = arr, .bucket = bucket, .next = 0};
 
-  return s;
+  str_parallel_spawn(str_sort_worker, &job, threads);
+
+  str_sort_permute(arr, sorted, len);
+
+  free(items);
+  free(sorted);
+  free(bucket);
+}
+
+static void *str_sort_worker(void *arg) {
+  str_sort_job_t *job = arg;
+
+  for (;;) {
+    size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+
+    if (i >= STR_SORT_BUCKETS)
+      break;
+
+    size_t n = job->bucket[i + 1] - job->bucket[i];
+
+    if (n > 1)
+      str_sort_mkqs(job->items + job->bucket[i], n, job->arr, 0);
+  }
+
+  return (void *)0;
 }
 
+#endif
+
 /**
- * string: pointer to the string
- * offset: offset to insert-position
- * data: pointer to the insert data
- * data_len: length of the insert data
+ * returns a writable buffer of s with room for len chars and a null byte
+ * len has to be >= s->len, the current content is kept
+ *
+ * inline strings stay inline as long as len fits, strings that are not owned
+ * (borrowed, stack allocated) are copied first, owned heap buffers grow
+ * geometrically so repeated appends are amortized O(1)
  * */
-void str_mem_insert(string_t *string, size_t offset, void *data,
-                    size_t data_len) {
-
-  if (!string)
-    return;
+static char *str_writable(string_t *s, size_t len) {
 
-  if (!data)
-    return;
+  if (s->flags & STR_HEAP && s->flags & STR_OWNER) {
+    if (len <= s->cap)
+      return s->str;
 
-  if (offset > string->len)
-    offset = string->len;
+    return str_realloc(s, str_grow_cap(s->cap, len));
+  }
 
-  str_heapify(string);
+  if (s->flags & STR_SSO && len <= STR_SSO_CAP)
+    return s->sso;
 
-  string->str = realloc(string->str, string->len + data_len + 1);
+  if (len <= STR_SSO_CAP) {
+    // the chars are copied over str, a shared block is released after
+    str_shared_t *shared =
+        s->flags & STR_SHARED ? s->shared : (str_shared_t *)0;
 
-  if (!string->str)
-    return;
+    memmove(s->sso, str_ptr(s), s->len);
+    *(s->sso + s->len) = 0;
 
-  memmove(string->str + offset + data_len, string->str + offset,
-          string->len - offset);
+    if (shared)
+      str_shared_release(shared);
 
-  memcpy(string->str + offset, data, data_len);
+    s->flags = STR_SSO;
 
-  string->len += data_len;
+    return s->sso;
+  }
 
-  *(string->str + string->len) = 0;
+  // first heap buffer: exact if the length stays, room to grow otherwise
+  return str_realloc(s, len == s->len ? len : str_grow_cap(s->len, len));
 }
 
 /**
- * string: pointer to the string
- * offset: offset to the replaced-start
- * len: length of the replaced string
- * data: pointer to the replacement data
- * data_len: length of the replacement data
+ * moves s into an owned heap buffer for exactly cap chars and a null byte
+ * cap has to be >= s->len
  * */
-void str_mem_replace(string_t *string, size_t offset, size_t len, void *data,
-                     size_t data_len) {
+static char *str_realloc(string_t *s, size_t cap) {
 
-  if (!string)
-    return;
+  char *tmp;
 
-  if (!data)
-    return;
+  if (s->flags & STR_HEAP && s->flags & STR_OWNER) {
+    tmp = realloc(s->str, cap + 1);
 
-  if (offset >= string->len)
-    offset = string->len - 1;
+    if (!tmp)
+      return (char *)0;
+  } else {
+    tmp = malloc(cap + 1);
 
-  if (offset + len > string->len)
-    len = string->len - offset;
+    if (!tmp)
+      return (char *)0;
 
-  str_heapify(string);
+    memcpy(tmp, str_ptr(s), s->len);
+    *(tmp + s->len) = 0;
 
-  string->str = realloc(string->str, string->len + data_len - len + 1);
+    // detaches from the other references
+    if (s->flags & STR_SHARED)
+      str_shared_release(s->shared);
 
-  if (!string->str)
-    return;
+    s->flags = STR_HEAP | STR_OWNER;
+  }
 
-  memmove(string->str + offset + data_len, string->str + offset + len,
-          string->len - offset - len);
+  s->str = tmp;
+  s->cap = cap;
+
+  return tmp;
+}
+
+/**
+ * doubles cap until it can hold len chars
+ * */
+static size_t str_grow_cap(size_t cap, size_t len) {
 
-  memcpy(string->str + offset, data, data_len);
+  if (cap < STR_SSO_SIZE)
+    cap = STR_SSO_SIZE;
 
-  string->len += data_len - len;
+  while (cap < len) {
+    if (cap > (size_t)-1 / 2)
+      return len;
 
-  *(string->str + string->len) = 0;
+    cap *= 2;
+  }
+
+  return cap;
 }
 
 /**
- * string: pointer to the string
- * len: new string length
- * data: data to be appended
- * data_len: size of the data to be appended
+ * shrinks s to the part [offset, offset + len)
+ * owned strings are shrunk in place, others get a copy of the part
  * */
-void str_mem_append(string_t *string, void *data, size_t data_len) {
+static void str_keep(string_t *s, size_t offset, size_t len) {
 
-  if (!string)
-    return;
+  if (s->flags & STR_SSO || (s->flags & STR_HEAP && s->flags & STR_OWNER)) {
+    char *c = str_writable(s, s->len);
 
-  if (!data)
+    if (!c)
+      return;
+
+    memmove(c, c + offset, len);
+    *(c + len) = 0;
+
+    s->len = len;
     return;
+  }
 
-  str_heapify(string);
+  string_t tmp;
+  str_clone_from_chr(&tmp, str_ptr(s) + offset, len);
 
-  string->str = realloc(string->str, string->len + data_len + 1);
+  if (s->flags & STR_SHARED)
+    str_shared_release(s->shared);
 
-  if (!string->str)
-    return;
+  *s = tmp;
+}
 
-  memcpy(string->str + string->len, data, data_len);
-  string->len += data_len;
+static void str_shared_retain(str_shared_t *head) {
+  __atomic_add_fetch(&head->refs, 1, __ATOMIC_RELAXED);
+}
 
-  // add null terminator
-  *(string->str + string->len) = 0;
+/**
+ * drops a reference, the last one frees the chars
+ * */
+static void str_shared_release(str_shared_t *head) {
+
+  if (!__atomic_sub_fetch(&head->refs, 1, __ATOMIC_ACQ_REL)) {
+    free(head->str);
+    free(head);
+  }
 }
 
-#endif
+#endif
\ No newline at end of file
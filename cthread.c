@@ -52,6 +52,10 @@ int thread_cancel(thread_t *thread) {
   return pthread_cancel(thread->thread);
 }
 
+int thread_join(thread_t *thread, void **ret) {
+  return pthread_join(thread->thread, ret);
+}
+
 thread_pool_t *thread_pool_create(unsigned int size) {
   thread_pool_t *pool = malloc(sizeof(thread_pool_t)); 
 
@@ -38,6 +38,7 @@ typedef struct {
 int thread_start(thread_t *thread);
 int thread_start_attr(thread_t *thread, thread_attr_t attr);
 int thread_cancel(thread_t *thread);
+int thread_join(thread_t *thread, void **ret);
 
 thread_pool_t *thread_pool_create(unsigned int size);
 int thread_pool_append(thread_pool_t *pool, thread_t *thread);
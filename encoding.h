@@ -52,6 +52,10 @@
                                                                                \
     name##_r(&s->str);                                                         \
                                                                                \
+    /* the buffer was reallocated to exactly fit the new content */            \
+    s->len = s->str ? strlen(s->str) : 0;                                      \
+    s->cap = s->len;                                                           \
+                                                                               \
     return s;                                                                  \
   }
 
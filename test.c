@@ -1,16 +1,22 @@
 #include "stdio.h"
 #include "cargs.h"
 #define CSTRING_IMPLEMENTATION
+#define CSTRING_PARALLEL
 #include "cstring.h"
 #undef CSTRING_IMPLEMENTATION
 #define ENCODING_IMPLEMENTATION
 #include "encoding.h"
 #undef ENCODING_IMPLEMENTATION
 #include "cthread.h"
+#ifdef TEST_CREGEX
+#define CREGEX_IMPLEMENTATION
+#include "cregex.h"
+#endif // TEST_CREGEX
 #include <pthread.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <assert.h>
+#include <time.h>
 
 #define TEST_PASSED(n) assert(n); printf("\033[1;92mtest passed: " #n "\033[0m\n");
 
@@ -61,6 +67,16 @@ void ARG_HANDLER(,) {
 }
 #endif // TEST_CARGS
 
+#ifdef BENCH_CSTRING
+
+static double bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+#endif // BENCH_CSTRING
+
 #ifdef TEST_CTHREAD
 
 thread_fn_t thread_fn(int* arg) {
@@ -102,10 +118,586 @@ int main(int argc, char** argv) {
   
 #endif // TEST_CTHREAD
 
+#ifdef TEST_CREGEX
+  {
+    // nested stars make cycles of splits in the NFA
+    cregex_t *r = cregex_compile("(a*|b)*c", NULL);
+    TEST_PASSED(cregex_match_entire(r, "abbaac") &&
+                !cregex_match_entire(r, "abca"));
+    cregex_free(r);
+
+    // 2^11 DFA states
+    r = cregex_compile("(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)",
+                       NULL);
+    TEST_PASSED(cregex_match_entire(r, "bbbabbbbbbbbbb") &&
+                !cregex_match_entire(r, "abbbbbbbbbbb"));
+    // [0, a), a, b and (b, 255] are the only classes
+    TEST_PASSED(r->nclasses == 4);
+    cregex_free(r);
+
+    r = cregex_compile("a.c", NULL);
+    TEST_PASSED(cregex_match_entire(r, "a\377c") && cregex_search(r, "xxabc"));
+    cregex_free(r);
+
+    // the lazy cache only holds a few states and is flushed while matching
+    r = cregex_compile_lazy(
+        "(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)", 1024, NULL);
+    TEST_PASSED(r->fwd.nstates == 1);
+    TEST_PASSED(cregex_match_entire(r, "ababababababbbbbbbbbb") &&
+                !cregex_match_entire(r, "abbbbbbbbbbb") &&
+                cregex_search(r, "ccbabbbbbbbbbb"));
+    TEST_PASSED(r->fwd.cache_used <= 1024 && r->any.cache_used <= 1024);
+    cregex_free(r);
+
+    // the search DFAs of a(a|b){18} would have 2^18 states, they start empty
+    r = cregex_compile("a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)"
+                       "(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)",
+                       NULL);
+    TEST_PASSED(r->any.nstates == 1 && r->rev.nstates == 1);
+    TEST_PASSED(cregex_match_entire(r, "abbbbbbbbbbbbbbbbbb") &&
+                r->any.nstates == 1 && r->rev.nstates == 1);
+    TEST_PASSED(cregex_search(r, "bbbabababababababababab") &&
+                r->any.nstates > 1);
+    cregex_free(r);
+
+    // leftmost-longest, empty matches do not count
+    size_t start, end;
+    r = cregex_compile("ab*|b*c", NULL);
+    TEST_PASSED(cregex_find(r, "xxbbcabbb", 9, &start, &end) && start == 2 &&
+                end == 5);
+    TEST_PASSED(!cregex_find(r, "xxx", 3, &start, &end) &&
+                !cregex_search(r, "xxx"));
+    cregex_free(r);
+  }
+#endif // TEST_CREGEX
+
 #ifdef TEST_CSTRING
-  
+  {
+    // short strings are stored inline
+    str_auto s_short = str_tolower(str("Content-Type"));
+    TEST_PASSED(s_short.flags & STR_SSO);
+    // the inline chars overlap the heap fields
+    TEST_PASSED(sizeof(string_t) <= 4 * sizeof(size_t));
+    // common header names of up to 22 chars stay inline as well
+    str_auto s_name = str_null, s_longest = str_null, s_longer = str_null;
+    str_clone(&s_name, str("content-disposition"));
+    str_clone(&s_longest, str("x-content-type-options"));
+    str_clone(&s_longer, str("strict-transport-security"));
+    TEST_PASSED(s_name.flags & STR_SSO && s_longest.flags & STR_SSO &&
+                s_longer.flags & STR_HEAP);
+    TEST_PASSED(str_equals(s_longest, str("x-content-type-options")));
+    TEST_PASSED(str_equals(s_short, str("content-type")));
+
+    // growing past the inline capacity moves the string to the heap
+    strr_cat(&s_short, "%s", ": application/json");
+    TEST_PASSED(s_short.flags & STR_HEAP);
+    TEST_PASSED(str_equals(s_short, str("content-type: application/json")));
+
+    str_auto s_trim = str_trim(str("  token \t"));
+    TEST_PASSED(str_equals(s_trim, str("token")));
+
+    str_auto s_pad = str_lpad(str("7"), '0', 3);
+    TEST_PASSED(str_equals(s_pad, str("007")));
+
+    str_auto s_rev = str_rev(str("abc"));
+    TEST_PASSED(str_equals(s_rev, str("cba")));
+
+    tokenizer_t tok = str_token_init(str("a,,bc,d"), str(","));
+    str_auto token = str_null;
+    size_t n = 0;
+    while (str_token_next(&tok, &token))
+      n++;
+    TEST_PASSED(n == 3);
+  }
+  {
+    string_t s_log = str("level=info  msg=started\tport=8080 ");
+    tokenizer_t tok = str_token_init_flags(s_log, str(" \t"),
+                                           STR_TOKEN_ANY | STR_TOKEN_COLLAPSE);
+    string_t token;
+    size_t n = 0;
+    while (str_token_next_view(&tok, &token))
+      n++;
+    TEST_PASSED(n == 3 && str_equals(token, str("port=8080")));
+    TEST_PASSED(token.str == s_log.str + 24);
+
+    tok = str_token_init_flags(str("a,,b,"), str(","), 0);
+    n = 0;
+    while (str_token_next_view(&tok, &token))
+      n++;
+    TEST_PASSED(n == 4 && token.len == 0);
+  }
+  {
+    // appends grow the capacity geometrically
+    str_auto s_append = str_null;
+    TEST_PASSED(str_reserve(&s_append, 64) && s_append.cap == 64);
+    for (int i = 0; i < 100; i++)
+      str_mem_append(&s_append, "0123456789", 10);
+    TEST_PASSED(s_append.len == 1000 && s_append.cap >= 1000);
+
+    str_shrink_to_fit(&s_append);
+    TEST_PASSED(s_append.cap == s_append.len);
+  }
+  {
+    // long enough for the simd kernels and their scalar tails
+    string_t s_hay = str("GET /index.html HTTP/1.1 Host: example.org "
+                         "Accept: */* Connection: keep-alive");
+    TEST_PASSED(str_pos(s_hay, str("keep-alive")) == 67);
+    TEST_PASSED(str_pos(s_hay, str("keep-alivE")) == (size_t)-1);
+    TEST_PASSED(str_ipos(s_hay, str("CONNECTION")) == 55);
+    TEST_PASSED(str_pos(s_hay, str("G")) == 0);
+  }
+  {
+    // 40 chars: one avx2 block, sse2/swar tail; non ascii bytes stay as is
+    string_t s_header = str("X-Forwarded-For-Original-Client-\xC4\xe4-Addr");
+    str_auto s_lower = str_tolower(s_header);
+    str_auto s_upper = str_toupper(s_header);
+    TEST_PASSED(str_equals(s_lower,
+                           str("x-forwarded-for-original-client-\xC4\xe4-addr")));
+    TEST_PASSED(str_equals_ic(s_upper, s_header));
+    TEST_PASSED(!str_equals_ic(s_upper, str("X-FORWARDED-FOR-ORIGINAL-CLIENT-"
+                                            "\xC4\xC4-ADDR")));
+    TEST_PASSED(str_hash_ic(s_lower) == str_hash_ic(s_upper));
+  }
+  {
+    str_searcher_t s_comma, s_periodic;
+    str_searcher_init(&s_comma, str(", "));
+    str_searcher_init(&s_periodic, str("abab"));
+    TEST_PASSED(s_comma.algo == STR_SEARCH_HORSPOOL);
+    TEST_PASSED(s_periodic.algo == STR_SEARCH_TWOWAY);
+    TEST_PASSED(str_searcher_find(&s_periodic, str("aabbababab")) == 4);
+
+    size_t *positions, n;
+    str_searcher_find_all(&s_comma, str("a, b, c"), &positions, &n);
+    TEST_PASSED(n == 2 && positions[0] == 1 && positions[1] == 4);
+    free(positions);
+
+    str_auto s_joined = str_replace_searcher(str("a, b, c"), &s_comma, str(";"));
+    TEST_PASSED(str_equals(s_joined, str("a;b;c")));
+
+    str_searcher_free(&s_comma);
+    str_searcher_free(&s_periodic);
+  }
+  {
+    str_auto s_fmt = str_cat(str("id="), "%05d %x %zu %.2f [%-4s]", -42, 255u,
+                             (size_t)7, 2.5, "ab");
+    TEST_PASSED(str_equals(s_fmt, str("id=-0042 ff 7 2.50 [ab  ]")));
+  }
+  {
+    string_t patterns[] = {str("&"), str("<"), str(">"), str("<br>")};
+    string_t replacements[] = {str("&amp;"), str("&lt;"), str("&gt;"),
+                               str("\n")};
+    str_auto s_escaped =
+        str_replace_many(str("a<b> & c<br>"), patterns, replacements, 4);
+    TEST_PASSED(str_equals(s_escaped, str("a&lt;b&gt; &amp; c\n")));
+
+    // the long pattern fails late at every position of the run
+    string_t s_pair[] = {str("a"), str("aaaaaaaaaaaaaaaaaaaaaaaab")};
+    string_t s_with[] = {str("x"), str("Y")};
+    str_auto s_run = str_replace_many(str("aaaaaaaaaaaaaaaaaaaaaaaaaaaaab"),
+                                      s_pair, s_with, 2);
+    TEST_PASSED(str_equals(s_run, str("xxxxxY")));
+  }
+  {
+    string_t s_line = str("GET /index.html HTTP/1.1");
+    string_t parts[4];
+    size_t n = str_explode_into(&s_line, str(" "), parts, 4);
+    TEST_PASSED(n == 3 && str_equals(parts[1], str("/index.html")));
+    TEST_PASSED(!(parts[1].flags & STR_OWNER) && parts[0].str == s_line.str);
+  }
+  {
+    string_t parts[] = {str("GET"), str("/index.html"), str_null,
+                        str("HTTP/1.1")};
+    string_t delimiter = str(" ");
+
+    str_auto s_line = str_implode(delimiter, parts, 4);
+    TEST_PASSED(str_equals(s_line, str("GET /index.html  HTTP/1.1")));
+
+    strr_implode(&s_line, str(""), parts, 2);
+    TEST_PASSED(s_line.len == 39 && s_line.cap == 39);
+
+    struct iovec iov[8];
+    size_t n = str_implode_iov(&delimiter, parts, 4, iov, 8);
+    TEST_PASSED(n == 6 && iov[4].iov_base == str_ptr(&delimiter));
+  }
+  {
+    string_t words[] = {str("b"), str("ab"), str(""), str("abcdefghij"),
+                        str("abcdefgh"), str("a"), str("abcdefghi")};
+    str_sort(words, 7);
+    TEST_PASSED(str_equals(words[0], str("")) &&
+                str_equals(words[1], str("a")) &&
+                str_equals(words[3], str("abcdefgh")) &&
+                str_equals(words[5], str("abcdefghij")) &&
+                str_equals(words[6], str("b")));
+
+    size_t n = STR_SORT_PARALLEL_MIN + 1000;
+    string_t *keys = malloc(n * sizeof(string_t));
+    string_t *ref = malloc(n * sizeof(string_t));
+    for (size_t i = 0; i < n; i++) {
+      keys[i] = str_cat(str("key_"), "%zu", (i * 7919) % 5000);
+      ref[i] = keys[i];
+    }
+
+    str_sort_parallel(keys, n, 4);
+    qsort(ref, n, sizeof(string_t), str_sort_cmp);
+
+    int sorted = 1;
+    for (size_t i = 0; i < n; i++)
+      sorted &= str_equals(keys[i], ref[i]);
+    TEST_PASSED(sorted);
+
+    for (size_t i = 0; i < n; i++)
+      str_free(keys + i);
+    free(keys);
+    free(ref);
+  }
+  {
+    string_t paths[] = {str("/usr/bin"), str("/usr/lib"), str("/usr/lib64"),
+                        str("/usr/local/bin"), str("/usr/local/lib"),
+                        str("/var/log")};
+    str_dict_t dict;
+    TEST_PASSED(str_dict_build(&dict, paths, 6));
+    TEST_PASSED(str_dict_find(&dict, str("/usr/lib64")) == 2 &&
+                str_dict_find(&dict, str("/usr/li")) == -1);
+
+    str_auto s_path = str_dict_get(&dict, 4);
+    TEST_PASSED(str_equals(s_path, str("/usr/local/lib")));
+
+    str_dict_iter_t it;
+    string_t s_entry;
+    size_t n = 0;
+    str_dict_iter(&dict, str("/usr/l"), &it);
+    while (str_dict_next(&it, &s_entry))
+      n += str_equals(s_entry, paths[1 + n]);
+    TEST_PASSED(n == 4);
+
+    str_dict_iter_free(&it);
+    str_dict_free(&dict);
+
+    string_t unsorted[] = {str("b"), str("a")};
+    TEST_PASSED(!str_dict_build(&dict, unsorted, 2));
+  }
+  {
+    string_t s_corpus = str("abracadabra, abracadabra");
+    str_index_t index;
+    TEST_PASSED(str_index_build(&index, &s_corpus));
+    TEST_PASSED(str_index_count(&index, str("abra")) == 4 &&
+                str_index_count(&index, str("cab")) == 0 &&
+                str_index_pos(&index, str("ra,")) == 9);
+
+    size_t pos[2];
+    TEST_PASSED(str_index_locate(&index, str("dab"), pos, 2) == 2 &&
+                pos[0] + pos[1] == 6 + 19);
+
+    int fds[2];
+    size_t size = sizeof(str_index_header_t) + s_corpus.len * sizeof(size_t);
+    char *data = malloc(size);
+    TEST_PASSED(!pipe(fds) && str_index_save(&index, fds[1]) &&
+                read(fds[0], data, size) == (ssize_t)size);
+    close(fds[0]);
+    close(fds[1]);
+
+    str_index_t loaded;
+    string_t s_other = str("abracadabra, abracadabrx");
+    TEST_PASSED(str_index_load(&loaded, &s_corpus, data, size) &&
+                str_index_count(&loaded, str("a")) == 10 &&
+                !str_index_load(&loaded, &s_other, data, size));
+
+    // a suffix array entry outside of the text
+    ((size_t *)(data + sizeof(str_index_header_t)))[3] = s_corpus.len;
+    TEST_PASSED(!str_index_load(&loaded, &s_corpus, data, size));
+
+    str_index_free(&loaded);
+    str_index_free(&index);
+    free(data);
+
+    // an inline corpus is indexed where it is stored
+    str_auto s_short = str_null;
+    str_clone_from_chr(&s_short, "bananabanana", 12);
+    TEST_PASSED(str_index_build(&index, &s_short) &&
+                str_index_count(&index, str("ana")) == 4);
+    str_index_free(&index);
+  }
+  {
+    TEST_PASSED(str_edit_distance(str("kitten"), str("sitting")) == 3 &&
+                str_edit_distance(str(""), str("abc")) == 3);
+    TEST_PASSED(str_edit_distance_bounded(str("kitten"), str("sitting"), 2) ==
+                -1);
+
+    // longer than one 64 bit block
+    str_auto s_long = str_rpad(str("prefix"), 'x', 100);
+    str_auto s_changed = str_rpad(str("prefiy"), 'x', 99);
+    TEST_PASSED(str_edit_distance(s_long, s_changed) == 2);
+
+    string_t names[] = {str("content-type"), str("content-length"),
+                        str("contnet-typ")};
+    size_t dist[3];
+    str_edit_distance_batch(str("content-type"), names, 3, 3, dist);
+    TEST_PASSED(dist[0] == 0 && dist[1] == (size_t)-1 && dist[2] == 3);
+
+    size_t len = 0;
+    TEST_PASSED(str_fuzzy_pos(str("GET /indx.html HTTP"), str("index.html"), 1,
+                              &len) == 5 &&
+                len == 9);
+  }
+  {
+    uint64_t u = 0;
+    int64_t i = 0;
+    size_t end = 0;
+    TEST_PASSED(str_parse_u64(str("18446744073709551615"), &u, (size_t *)0) ==
+                    STR_PARSE_OK &&
+                u == UINT64_MAX);
+    TEST_PASSED(str_parse_u64(str("18446744073709551616"), &u, (size_t *)0) ==
+                    STR_PARSE_OVERFLOW &&
+                u == UINT64_MAX);
+    TEST_PASSED(str_parse_i64(str("-9223372036854775808"), &i, (size_t *)0) ==
+                    STR_PARSE_OK &&
+                i == INT64_MIN);
+    TEST_PASSED(str_parse_i64(str("12345678901x"), &i, (size_t *)0) ==
+                    STR_PARSE_INVALID &&
+                str_parse_i64(str("+12345678901x"), &i, &end) == STR_PARSE_OK &&
+                i == 12345678901ll && end == 12);
+
+    char buf[STR_FMT_U64_MAX];
+    size_t n = str_fmt_u64(buf, 10203040506070809ull);
+    TEST_PASSED(n == 17 && !memcmp(buf, "10203040506070809", 17));
+  }
+  {
+    string_t s_name = str("content-length");
+    str_builder_t b;
+    str_builder_init(&b);
+
+    str_builder_add(&b, s_name);
+    str_builder_cat(&b, ": ");
+    str_builder_fill(&b, ' ', 30);
+    str_builder_int(&b, -1234567890123ll);
+    str_builder_uint(&b, 42);
+
+    int fds[2];
+    char out[128] = {0};
+    TEST_PASSED(!pipe(fds) && str_builder_write(&b, fds[1]) == 62 &&
+                read(fds[0], out, sizeof(out)) == 62);
+    close(fds[0]);
+    close(fds[1]);
+
+    str_auto s_line = str_builder_finish(&b);
+    TEST_PASSED(s_line.len == 62 && s_line.cap == 62 && !b.n &&
+                !memcmp(str_ptr(&s_line), out, 62) &&
+                !memcmp(out + 46, "-123456789012342", 16));
+  }
+  {
+    // the runs outgrow the inline buffer and the writev run buffer
+    str_builder_t b;
+    str_builder_init(&b);
+
+    str_builder_fill(&b, '=', STR_BUILDER_RUN + 904);
+    str_builder_cat(&b, "|");
+    str_builder_fill(&b, '.', 2 * STR_BUILDER_RUN + 808);
+
+    size_t len = 3 * STR_BUILDER_RUN + 1713, got = 0;
+    char *out = malloc(len);
+    ssize_t k = 1;
+
+    int fds[2];
+    TEST_PASSED(!pipe(fds) && str_builder_write(&b, fds[1]) == (ssize_t)len);
+    close(fds[1]);
+    while (got < len && (k = read(fds[0], out + got, len - got)) > 0)
+      got += (size_t)k;
+    close(fds[0]);
+
+    str_auto s_runs = str_builder_finish(&b);
+    TEST_PASSED(got == len && s_runs.len == len &&
+                !memcmp(str_ptr(&s_runs), out, len));
+    TEST_PASSED(out[STR_BUILDER_RUN + 903] == '=' &&
+                out[STR_BUILDER_RUN + 904] == '|' &&
+                out[STR_BUILDER_RUN + 905] == '.' && out[len - 1] == '.');
+
+    free(out);
+  }
+  {
+    // matches cross the 1 MiB chunk borders, "aXa" overlaps itself
+    size_t len = STR_PARALLEL_MIN + 12345;
+    char *c = malloc(len + 1);
+    for (size_t i = 0; i < len; i++)
+      c[i] = "aXa-"[(i * 7 + i / 1000) % 4];
+    c[len] = 0;
+
+    string_t s_big = str_null;
+    str_borrow(&s_big, c, len);
+
+    TEST_PASSED(str_pos_parallel(s_big, str("-aXa-"), 4) ==
+                str_pos(s_big, str("-aXa-")));
+    TEST_PASSED(str_count_parallel(s_big, str("aXa"), 4) ==
+                str_count(s_big, str("aXa")));
+
+    str_auto s_seq = str_replace(s_big, str("aXa"), str("<>"));
+    str_auto s_par = str_replace_parallel(s_big, str("aXa"), str("<>"), 4);
+    TEST_PASSED(str_equals(s_seq, s_par));
+
+    free(c);
+  }
+  {
+    str_map_t headers;
+    str_map_init(&headers, 0x5eed);
+
+    string_t s_line = str("Host: a.org\r\nAccept: */*\r\nHost: b.org");
+    string_t s_host = str_null, s_accept = str_null;
+    str_borrow(&s_host, str_ptr(&s_line), 4);
+    str_borrow(&s_accept, str_ptr(&s_line) + 13, 6);
+
+    TEST_PASSED(str_hash(s_host, 1) != str_hash(s_host, 2));
+    TEST_PASSED(str_map_put(&headers, s_host, "a.org"));
+    TEST_PASSED(str_map_put(&headers, s_accept, "*/*"));
+    TEST_PASSED(str_map_put(&headers, str("Host"), "b.org"));
+    TEST_PASSED(headers.len == 2);
+    TEST_PASSED(!strcmp(str_map_get(&headers, str("Host")), "b.org"));
+    TEST_PASSED(str_map_remove(&headers, str("Accept")));
+    TEST_PASSED(!str_map_find(&headers, s_accept) && headers.len == 1);
+
+    // the map doesn't own its keys, they live in the arena
+    str_arena_t *keys = str_arena_create(0);
+    for (int i = 0; i < 1000; i++)
+      str_map_put(&headers, str_arena_cat(keys, str_null, "x-header-%d", i),
+                  (void *)0);
+
+    size_t pos = 0, n = 0;
+    str_map_entry_t *entry;
+    while ((entry = str_map_next(&headers, &pos)))
+      n++;
+    TEST_PASSED(n == 1001 && str_map_find(&headers, str("x-header-999")));
+
+    str_map_free(&headers);
+    str_arena_destroy(keys);
+  }
+  {
+    char *payload = malloc(64);
+    memset(payload, 'p', 63);
+    payload[63] = 0;
+
+    str_auto s_payload = str_acquire(payload);
+    str_auto s_ref = str_share(&s_payload);
+    str_auto s_copy = str_null;
+    str_clone(&s_copy, s_payload);
+    TEST_PASSED(s_ref.flags & STR_SHARED && s_copy.str == s_payload.str);
+    // sharing leaves the chars where they are
+    TEST_PASSED(s_payload.str == payload && s_payload.shared->refs == 3);
+
+    // the first modification detaches a private copy
+    strr_cat(&s_ref, "%s", "!");
+    TEST_PASSED(s_ref.flags & STR_OWNER && s_ref.str != s_payload.str);
+    TEST_PASSED(s_ref.len == 64 && s_payload.len == 63);
+  }
+  {
+    str_intern_t names;
+    str_intern_init(&names);
+
+    char field[] = "content-length";
+    string_t s_first = str_intern(&names, str("content-length"));
+    string_t s_again = str_intern(&names, str(field));
+    string_t s_other = str_intern(&names, str("content-type"));
+    TEST_PASSED(str_intern_equals(s_first, s_again) && s_again.str != field);
+    TEST_PASSED(!str_intern_equals(s_first, s_other));
+    TEST_PASSED(str_intern_hash(s_first) == str_intern_hash(s_again));
+    TEST_PASSED(str_intern_find(&names, str("host")).str == (char *)0);
+
+    str_intern_free(&names);
+  }
+  {
+    str_arena_t *arena = str_arena_create(0);
+    string_t s_body = str_arena_clone(arena, str("<html><body>hello world</body></html>"));
+    TEST_PASSED(s_body.flags & STR_ARENA);
+
+    string_t s_new = str_arena_replace(arena, s_body, str("world"), str("arena"));
+    TEST_PASSED(str_equals(s_new, str("<html><body>hello arena</body></html>")));
+
+    string_t s_tag = str_arena_substr(arena, s_new, 1, 4);
+    TEST_PASSED(str_equals(s_tag, str("html")));
+
+    string_t s_cat = str_arena_cat(arena, s_tag, "%s%d", " v", 5);
+    TEST_PASSED(str_equals(s_cat, str("html v5")));
+
+    // no-op for arena strings
+    str_free(&s_new);
+
+    str_arena_reset(arena);
+    str_arena_destroy(arena);
+  }
 #endif
 
+#ifdef BENCH_CSTRING
+  {
+    const int n = 1000000;
+    size_t total = 0;
+
+    double start = bench_now();
+    for (int i = 0; i < n; i++) {
+      str_auto s_bench = str_cat(str("user="), "%s id=%d len=%zu", "admin", i,
+                                 (size_t)i * 3);
+      total += s_bench.len;
+    }
+    double t_str = bench_now() - start;
+
+    start = bench_now();
+    for (int i = 0; i < n; i++) {
+      int len = snprintf((char *)0, 0, "user=%s id=%d len=%zu", "admin", i,
+                         (size_t)i * 3);
+      char *c = malloc((size_t)len + 1);
+      snprintf(c, (size_t)len + 1, "user=%s id=%d len=%zu", "admin", i,
+               (size_t)i * 3);
+      total += (size_t)len;
+      free(c);
+    }
+    double t_snprintf = bench_now() - start;
+
+    printf("str_cat: %.1f ns/op, snprintf: %.1f ns/op (%zu)\n", t_str / n,
+           t_snprintf / n, total);
+  }
+  {
+    const int n = 1000000;
+    char keys[1024][24];
+    str_map_t map;
+    str_map_init(&map, 1);
+
+    for (int i = 0; i < 1024; i++) {
+      snprintf(keys[i], sizeof(keys[i]), "field_name_%d", i);
+      str_map_put(&map, str(keys[i]), keys[i]);
+    }
+
+    size_t found = 0;
+    double start = bench_now();
+    for (int i = 0; i < n; i++)
+      found += str_map_get(&map, str(keys[i & 1023])) != (void *)0;
+    double t_map = bench_now() - start;
+
+    printf("str_map_get: %.1f ns/op (%zu)\n", t_map / n, found);
+
+    str_map_free(&map);
+  }
+  {
+    const size_t n = 1000000;
+    string_t *keys = malloc(n * sizeof(string_t));
+    string_t *ref = malloc(n * sizeof(string_t));
+    for (size_t i = 0; i < n; i++) {
+      keys[i] = str_cat(str("/usr/share/"), "%zu/%zx", (i * 7919) % n, i);
+      ref[i] = keys[i];
+    }
+
+    double start = bench_now();
+    str_sort(keys, n);
+    double t_sort = bench_now() - start;
+
+    start = bench_now();
+    qsort(ref, n, sizeof(string_t), str_sort_cmp);
+    double t_qsort = bench_now() - start;
+
+    printf("str_sort: %.1f ms, qsort: %.1f ms\n", t_sort / 1e6, t_qsort / 1e6);
+
+    for (size_t i = 0; i < n; i++)
+      str_free(keys + i);
+    free(keys);
+    free(ref);
+  }
+#endif // BENCH_CSTRING
+
   sleep(1);
 
   return 1;